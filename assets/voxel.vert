@@ -0,0 +1,14 @@
+#version 330 
+layout(location = 0) in ivec3 in_Position;
+layout(location = 1) in uint in_Color;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 palette[256];
+out vec3 pass_Color;
+void main(void)
+{
+mat4 mvp = projection * view * model;
+gl_Position = mvp * vec4(vec3(in_Position) * 2.0 - 1.0, 1.0);
+pass_Color = palette[min(in_Color, 255u)];
+}
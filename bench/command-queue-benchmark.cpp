@@ -0,0 +1,135 @@
+#include "command-queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Measures CommandQueue's MPSCQueue under contention: N producer threads queue commands as fast as they can while one
+// consumer drains them. Reports the sustained commands per second and the enqueue latency percentiles, next to a
+// mutex guarded vector as the baseline. Latencies include the cost of reading the clock.
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	// A command the size of the voxel edit commands, tagged with its producer and sequence number.
+	struct BenchmarkCommand : vv::Command<int> {
+		BenchmarkCommand(const int producer, const int sequence) : vv::Command<int>(0, 0), producer(producer),
+			sequence(sequence) {
+			this->padding[0] = this->padding[1] = this->padding[2] = 0.0f;
+		}
+		int producer;
+		int sequence;
+		float padding[3];
+	};
+
+	class LockFreeQueue {
+	public:
+		void Push(const int producer, const int sequence) {
+			this->queue.Emplace<BenchmarkCommand>(producer, sequence);
+		}
+
+		template <typename Visit>
+		size_t Drain(Visit visit) {
+			return this->queue.Drain([&visit] (vv::Command<int>* command) {
+				visit(*static_cast<BenchmarkCommand*>(command));
+			});
+		}
+	private:
+		vv::MPSCQueue<vv::Command<int>> queue;
+	};
+
+	// The baseline, each push and drain takes the lock.
+	class MutexQueue {
+	public:
+		void Push(const int producer, const int sequence) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->queue.push_back(BenchmarkCommand(producer, sequence));
+		}
+
+		template <typename Visit>
+		size_t Drain(Visit visit) {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->draining.swap(this->queue);
+			}
+			for (const BenchmarkCommand& command : this->draining) {
+				visit(command);
+			}
+			size_t count = this->draining.size();
+			this->draining.clear();
+			return count;
+		}
+	private:
+		std::mutex mutex;
+		std::vector<BenchmarkCommand> queue;
+		std::vector<BenchmarkCommand> draining;
+	};
+
+	template <typename Queue>
+	void Run(const char* name, const int producer_count, const int commands_per_producer) {
+		Queue queue;
+		std::vector<std::vector<double>> latencies(producer_count);
+		std::atomic<bool> start(false);
+
+		std::vector<std::thread> producers;
+		for (int producer = 0; producer < producer_count; ++producer) {
+			producers.emplace_back([&queue, &latencies, &start, producer, commands_per_producer] () {
+				std::vector<double>& latency = latencies[producer];
+				latency.reserve(commands_per_producer);
+				while (!start.load()) {
+				}
+				for (int sequence = 0; sequence < commands_per_producer; ++sequence) {
+					Clock::time_point before = Clock::now();
+					queue.Push(producer, sequence);
+					latency.push_back(std::chrono::duration<double, std::nano>(Clock::now() - before).count());
+				}
+			});
+		}
+
+		// Each producer's commands must come out in the order it queued them.
+		std::vector<int> next_sequence(producer_count, 0);
+		bool in_order = true;
+		const size_t total = static_cast<size_t>(producer_count) * commands_per_producer;
+		size_t drained = 0;
+		Clock::time_point begin = Clock::now();
+		start.store(true);
+		while (drained < total) {
+			drained += queue.Drain([&next_sequence, &in_order] (const BenchmarkCommand& command) {
+				if (command.sequence != next_sequence[command.producer]) {
+					in_order = false;
+				}
+				next_sequence[command.producer] = command.sequence + 1;
+			});
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+		for (std::thread& producer : producers) {
+			producer.join();
+		}
+
+		std::vector<double> all;
+		all.reserve(total);
+		for (const std::vector<double>& latency : latencies) {
+			all.insert(all.end(), latency.begin(), latency.end());
+		}
+		std::sort(all.begin(), all.end());
+		printf("%-9s %2d producers %8.2f M commands/s  enqueue p50 %6.0f ns  p99 %7.0f ns  p99.9 %8.0f ns  max %9.0f ns%s\n",
+			name, producer_count, total / seconds / 1e6, all[all.size() / 2], all[all.size() * 99 / 100],
+			all[all.size() * 999 / 1000], all.back(), in_order ? "" : "  OUT OF ORDER");
+	}
+}
+
+// Usage: CommandQueueBenchmark [commands per producer] [max producers]
+int main(int argc, char* argv[]) {
+	const int commands_per_producer = argc > 1 ? atoi(argv[1]) : 500000;
+	const int max_producers = argc > 2 ? atoi(argv[2]) : static_cast<int>(std::max(2u, std::thread::hardware_concurrency()));
+	for (int producer_count = 1; producer_count <= max_producers; producer_count *= 2) {
+		Run<LockFreeQueue>("mpsc", producer_count, commands_per_producer);
+		Run<MutexQueue>("mutex", producer_count, commands_per_producer);
+	}
+	return 0;
+}
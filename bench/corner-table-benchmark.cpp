@@ -0,0 +1,227 @@
+#include "voxelvolume.hpp"
+#include "vertexbuffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Times vertex deduplication with the lattice corner table against the float keyed std::map the mesher used before.
+// Each scene is meshed once, its triangles are expanded back into the stream of corners the mesher asked for and that
+// stream is deduplicated both ways. Both must produce byte identical vertex and index buffers. The replay dedupes
+// across the whole volume rather than per chunk, so its vertex counts are lower than the volume's own buffers.
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	// Exposes the protected edit functions so shapes can be built without going through the command queue.
+	class BenchmarkVolume : public vv::VoxelVolume {
+	public:
+		using vv::VoxelVolume::AddVoxel;
+		using vv::VoxelVolume::FillBox;
+		using vv::VoxelVolume::FillSphere;
+	};
+
+	const int RUNS = 5;
+
+	struct Corner {
+		int position[3];
+		unsigned short color;
+	};
+
+	struct Mesh {
+		std::vector<vv::PackedVertex> verts;
+		std::vector<unsigned int> indicies;
+	};
+
+	// FNV-1a over both buffers.
+	std::uint64_t Hash(const Mesh& mesh) {
+		std::uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash] (const void* data, const size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+		if (!mesh.verts.empty()) {
+			add(&mesh.verts[0], mesh.verts.size() * sizeof(vv::PackedVertex));
+		}
+		if (!mesh.indicies.empty()) {
+			add(&mesh.indicies[0], mesh.indicies.size() * sizeof(unsigned int));
+		}
+		return hash;
+	}
+
+	// The old lookup: the model space position (lattice * 2 - 1) as a tuple of floats. A position holds the most recent
+	// color, the same as a corner table entry.
+	void DedupeMap(const std::vector<Corner>& corners, Mesh& mesh) {
+		std::map<std::tuple<float, float, float>, std::pair<unsigned int, unsigned short>> index_list;
+		mesh.verts.clear();
+		mesh.indicies.clear();
+		for (const Corner& corner : corners) {
+			std::tuple<float, float, float> key(corner.position[0] * 2.0f - 1.0f, corner.position[1] * 2.0f - 1.0f,
+				corner.position[2] * 2.0f - 1.0f);
+			auto found = index_list.find(key);
+			if (found == index_list.end() || found->second.second != corner.color) {
+				unsigned int vert_index = static_cast<unsigned int>(mesh.verts.size());
+				mesh.verts.push_back(vv::PackedVertex(corner.position[0], corner.position[1], corner.position[2], corner.color));
+				index_list[key] = std::make_pair(vert_index, corner.color);
+				mesh.indicies.push_back(vert_index);
+			}
+			else {
+				mesh.indicies.push_back(found->second.first);
+			}
+		}
+	}
+
+	// The corner table lookup, a direct index into arrays covering the lattice from min to max. The generation stamp
+	// stands in for clearing the table between meshes.
+	class CornerTable {
+	public:
+		CornerTable(const int min[3], const int max[3]) : generation(0) {
+			for (int axis = 0; axis < 3; ++axis) {
+				this->min[axis] = min[axis];
+				this->size[axis] = max[axis] - min[axis] + 1;
+			}
+			size_t count = static_cast<size_t>(this->size[0]) * this->size[1] * this->size[2];
+			this->index.resize(count);
+			this->stamp.resize(count, 0);
+			this->color.resize(count);
+		}
+
+		void Dedupe(const std::vector<Corner>& corners, Mesh& mesh) {
+			++this->generation;
+			mesh.verts.clear();
+			mesh.indicies.clear();
+			for (const Corner& corner : corners) {
+				size_t slot = (corner.position[0] - this->min[0]) + ((corner.position[1] - this->min[1]) +
+					static_cast<size_t>(corner.position[2] - this->min[2]) * this->size[1]) * this->size[0];
+				if (this->stamp[slot] != this->generation || this->color[slot] != corner.color) {
+					this->index[slot] = static_cast<unsigned int>(mesh.verts.size());
+					this->stamp[slot] = this->generation;
+					this->color[slot] = corner.color;
+					mesh.verts.push_back(vv::PackedVertex(corner.position[0], corner.position[1], corner.position[2],
+						corner.color));
+				}
+				mesh.indicies.push_back(this->index[slot]);
+			}
+		}
+	private:
+		int min[3];
+		int size[3];
+		std::vector<unsigned int> index;
+		std::vector<unsigned int> stamp;
+		std::vector<unsigned short> color;
+		unsigned int generation;
+	};
+
+	// Milliseconds of the fastest of RUNS calls.
+	template <typename Dedupe>
+	double Time(Dedupe dedupe) {
+		double best_ms = 0.0;
+		for (int run = 0; run < RUNS; ++run) {
+			Clock::time_point begin = Clock::now();
+			dedupe();
+			double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+			if (run == 0 || elapsed_ms < best_ms) {
+				best_ms = elapsed_ms;
+			}
+		}
+		return best_ms;
+	}
+
+	// Returns false if the two lookups build different buffers.
+	bool Run(const char* name, BenchmarkVolume& volume, const vv::MESH_MODE mode) {
+		volume.SetMeshMode(mode);
+		volume.MarkAllDirty();
+		volume.UpdateVertexBuffers();
+		const std::vector<vv::PackedVertex>& verts = volume.GetVertexBuffer();
+		const std::vector<unsigned int>& indicies = volume.GetIndexBuffer();
+		if (verts.empty()) {
+			return true;
+		}
+
+		std::vector<Corner> corners;
+		corners.reserve(indicies.size());
+		int min[3] = { verts[0].position[0], verts[0].position[1], verts[0].position[2] };
+		int max[3] = { min[0], min[1], min[2] };
+		for (unsigned int index : indicies) {
+			Corner corner;
+			for (int axis = 0; axis < 3; ++axis) {
+				corner.position[axis] = verts[index].position[axis];
+				min[axis] = std::min(min[axis], corner.position[axis]);
+				max[axis] = std::max(max[axis], corner.position[axis]);
+			}
+			corner.color = verts[index].color;
+			corners.push_back(corner);
+		}
+
+		Mesh map_mesh, table_mesh;
+		CornerTable table(min, max);
+		double map_ms = Time([&] () { DedupeMap(corners, map_mesh); });
+		double table_ms = Time([&] () { table.Dedupe(corners, table_mesh); });
+		bool identical = Hash(map_mesh) == Hash(table_mesh);
+		printf("%-16s %-7s %9zu corners %9zu verts  map %9.3f ms  table %8.3f ms  %6.1fx  %s\n", name,
+			mode == vv::MESH_GREEDY ? "greedy" : "culled", corners.size(), table_mesh.verts.size(), map_ms, table_ms,
+			map_ms / table_ms, identical ? "identical" : "DIFFERENT");
+		return identical;
+	}
+
+	bool RunBoth(const char* name, BenchmarkVolume& volume) {
+		bool culled = Run(name, volume, vv::MESH_CULLED);
+		return Run(name, volume, vv::MESH_GREEDY) && culled;
+	}
+}
+
+// Returns 1 if any scene's buffers differ between the two lookups.
+int main() {
+	bool identical = true;
+
+	// A solid cube, only its outer shell is exposed.
+	{
+		BenchmarkVolume cube;
+		const short min[3] = { 0, 0, 0 };
+		const short max[3] = { 63, 63, 63 };
+		cube.FillBox(min, max);
+		identical = RunBoth("cube 64", cube) && identical;
+	}
+
+	// A sphere with a material per octant, corners on the seams are shared by two colors.
+	{
+		BenchmarkVolume sphere;
+		sphere.FillSphere(0, 0, 0, 32);
+		for (short row = -32; row <= 32; ++row) {
+			for (short column = -32; column <= 32; ++column) {
+				for (short slice = -32; slice <= 32; ++slice) {
+					if (sphere.IsSolid(row, column, slice)) {
+						sphere.AddVoxel(row, column, slice, vv::Voxel(row < 0 ? 0.2f : 0.8f, column < 0 ? 0.2f : 0.8f,
+							slice < 0 ? 0.2f : 0.8f));
+					}
+				}
+			}
+		}
+		identical = RunBoth("sphere r32", sphere) && identical;
+	}
+
+	// Every other voxel solid, the worst case for both.
+	{
+		BenchmarkVolume noise;
+		srand(7);
+		for (short row = 0; row < 64; ++row) {
+			for (short column = 0; column < 64; ++column) {
+				for (short slice = 0; slice < 64; ++slice) {
+					if (rand() % 2) {
+						noise.AddVoxel(row, column, slice);
+					}
+				}
+			}
+		}
+		identical = RunBoth("noise 64", noise) && identical;
+	}
+
+	return identical ? 0 : 1;
+}
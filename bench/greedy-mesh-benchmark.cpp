@@ -0,0 +1,170 @@
+#include "voxelvolume.hpp"
+#include "vertexbuffer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Reports the vertex count, index count and meshing time of MESH_CULLED and MESH_GREEDY on a few representative shapes.
+// Greedy quads are merged within a 16^3 chunk only, so a face spanning several chunks is split at every chunk border.
+// With --kernels each shape is meshed with every face mask kernel instead, and each kernel must build the same
+// buffers as the per voxel one.
+
+namespace {
+	// Exposes the protected edit functions so shapes can be built without going through the command queue.
+	class BenchmarkVolume : public vv::VoxelVolume {
+	public:
+		using vv::VoxelVolume::AddVoxel;
+		using vv::VoxelVolume::FillBox;
+		using vv::VoxelVolume::FillSphere;
+	};
+
+	const int RUNS = 5;
+
+	// Remeshes the whole volume RUNS times with mode and prints the counts and the fastest run.
+	void Run(const char* name, BenchmarkVolume& volume, const vv::MESH_MODE mode) {
+		volume.SetMeshMode(mode);
+		double best_ms = 0.0;
+		for (int run = 0; run < RUNS; ++run) {
+			volume.MarkAllDirty();
+			volume.UpdateVertexBuffers();
+			const double mesh_time_ms = volume.GetMeshStats().mesh_time_ms;
+			if (run == 0 || mesh_time_ms < best_ms) {
+				best_ms = mesh_time_ms;
+			}
+		}
+		const vv::MeshStats& stats = volume.GetMeshStats();
+		printf("%-16s %-7s %9zu voxels %8zu chunks %9zu verts %9zu indices %8zu quads %9.3f ms\n", name,
+			mode == vv::MESH_GREEDY ? "greedy" : "culled", volume.GetVoxelCount(), stats.chunks_meshed,
+			stats.vertex_count, stats.index_count, stats.faces_emitted, best_ms);
+	}
+
+	// FNV-1a over the volume's vertex and index buffers.
+	std::uint64_t HashBuffers(BenchmarkVolume& volume) {
+		std::uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash] (const void* data, const size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+		const std::vector<vv::PackedVertex>& verts = volume.GetVertexBuffer();
+		const std::vector<unsigned int>& indicies = volume.GetIndexBuffer();
+		if (!verts.empty()) {
+			add(&verts[0], verts.size() * sizeof(vv::PackedVertex));
+		}
+		if (!indicies.empty()) {
+			add(&indicies[0], indicies.size() * sizeof(unsigned int));
+		}
+		return hash;
+	}
+
+	// Runs mode once per face mask kernel. Kernels the CPU doesn't support are skipped.
+	bool RunKernels(const char* name, BenchmarkVolume& volume, const vv::MESH_MODE mode) {
+		const vv::FACE_MASK_KERNEL kernels[] = { vv::FACE_MASK_PER_VOXEL, vv::FACE_MASK_SCALAR, vv::FACE_MASK_AVX2 };
+		const char* kernel_names[] = { "per voxel", "scalar", "avx2" };
+		std::uint64_t reference_hash = 0;
+		bool identical = true;
+		for (int kernel = 0; kernel < 3; ++kernel) {
+			if (vv::SetFaceMaskKernel(kernels[kernel]) != kernels[kernel]) {
+				printf("%-16s %-7s %-9s unsupported\n", name, mode == vv::MESH_GREEDY ? "greedy" : "culled",
+					kernel_names[kernel]);
+				continue;
+			}
+			printf("%-9s ", kernel_names[kernel]);
+			Run(name, volume, mode);
+			std::uint64_t hash = HashBuffers(volume);
+			if (kernel == 0) {
+				reference_hash = hash;
+			}
+			else if (hash != reference_hash) {
+				printf("%-9s buffers differ from per voxel\n", kernel_names[kernel]);
+				identical = false;
+			}
+		}
+		vv::SetFaceMaskKernel(vv::FACE_MASK_AUTO);
+		return identical;
+	}
+
+	bool kernel_mode = false;
+	bool identical = true;
+
+	void RunBoth(const char* name, BenchmarkVolume& volume) {
+		if (kernel_mode) {
+			identical = RunKernels(name, volume, vv::MESH_CULLED) && identical;
+			identical = RunKernels(name, volume, vv::MESH_GREEDY) && identical;
+			return;
+		}
+		Run(name, volume, vv::MESH_CULLED);
+		Run(name, volume, vv::MESH_GREEDY);
+	}
+}
+
+// Usage: GreedyMeshBenchmark [--kernels]
+// Returns 1 if --kernels was given and a kernel built different buffers.
+int main(int argc, char* argv[]) {
+	kernel_mode = argc > 1 && strcmp(argv[1], "--kernels") == 0;
+	printf("Greedy quads stop at %d voxel chunk borders, an N x N face is split into at least ceil(N / %d)^2 quads.\n\n",
+		vv::VoxelChunk::SIZE, vv::VoxelChunk::SIZE);
+
+	// A single layer floor, the best case for greedy merging.
+	{
+		BenchmarkVolume floor;
+		const short min[3] = { 0, 0, 0 };
+		const short max[3] = { 0, 99, 99 };
+		floor.FillBox(min, max);
+		RunBoth("floor 100x100", floor);
+	}
+
+	// A solid cube, only its outer shell is exposed.
+	{
+		BenchmarkVolume cube;
+		const short min[3] = { 0, 0, 0 };
+		const short max[3] = { 63, 63, 63 };
+		cube.FillBox(min, max);
+		RunBoth("cube 64", cube);
+	}
+
+	// A sphere, curved surfaces leave only short runs to merge.
+	{
+		BenchmarkVolume sphere;
+		sphere.FillSphere(0, 0, 0, 32);
+		RunBoth("sphere r32", sphere);
+	}
+
+	// Height map terrain with a material per band of height.
+	{
+		BenchmarkVolume terrain;
+		const vv::Voxel bands[3] = { vv::Voxel(0.4f, 0.3f, 0.2f), vv::Voxel(0.2f, 0.6f, 0.2f), vv::Voxel(0.9f, 0.9f, 0.9f) };
+		srand(7);
+		int height = 8;
+		for (short column = 0; column < 128; ++column) {
+			for (short slice = 0; slice < 128; ++slice) {
+				height += rand() % 3 - 1;
+				height = height < 1 ? 1 : (height > 24 ? 24 : height);
+				for (short row = 0; row < height; ++row) {
+					terrain.AddVoxel(row, column, slice, bands[row * 3 / 25]);
+				}
+			}
+		}
+		RunBoth("terrain 128x128", terrain);
+	}
+
+	// Every other voxel solid, nothing can merge.
+	{
+		BenchmarkVolume noise;
+		srand(7);
+		for (short row = 0; row < 32; ++row) {
+			for (short column = 0; column < 32; ++column) {
+				for (short slice = 0; slice < 32; ++slice) {
+					if (rand() % 2) {
+						noise.AddVoxel(row, column, slice);
+					}
+				}
+			}
+		}
+		RunBoth("noise 32", noise);
+	}
+
+	return identical ? 0 : 1;
+}
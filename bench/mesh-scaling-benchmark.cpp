@@ -0,0 +1,129 @@
+#include "voxelvolume.hpp"
+#include "vertexbuffer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// Remeshes a few scenes with 1, 2, 4, 8 and 16 meshing threads and reports the time and speedup of each. Every thread
+// count must build byte identical buffers to the serial run. Speedup is bounded by the cores available.
+
+namespace {
+	// Exposes the protected edit functions so shapes can be built without going through the command queue.
+	class BenchmarkVolume : public vv::VoxelVolume {
+	public:
+		using vv::VoxelVolume::AddVoxel;
+		using vv::VoxelVolume::FillBox;
+		using vv::VoxelVolume::FillSphere;
+	};
+
+	const int RUNS = 5;
+
+	// FNV-1a over the volume's vertex and index buffers.
+	std::uint64_t HashBuffers(BenchmarkVolume& volume) {
+		std::uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash] (const void* data, const size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+		const std::vector<vv::PackedVertex>& verts = volume.GetVertexBuffer();
+		const std::vector<unsigned int>& indicies = volume.GetIndexBuffer();
+		if (!verts.empty()) {
+			add(&verts[0], verts.size() * sizeof(vv::PackedVertex));
+		}
+		if (!indicies.empty()) {
+			add(&indicies[0], indicies.size() * sizeof(unsigned int));
+		}
+		return hash;
+	}
+
+	// Remeshes the whole volume RUNS times with each thread count. Returns false if any buffers differ from the serial run.
+	bool Run(const char* name, BenchmarkVolume& volume, const vv::MESH_MODE mode) {
+		volume.SetMeshMode(mode);
+		const size_t thread_counts[] = { 1, 2, 4, 8, 16 };
+		std::uint64_t serial_hash = 0;
+		double serial_ms = 0.0;
+		bool identical = true;
+		for (size_t thread_count : thread_counts) {
+			volume.SetMeshThreadCount(thread_count);
+			double best_ms = 0.0;
+			for (int run = 0; run < RUNS; ++run) {
+				volume.MarkAllDirty();
+				volume.UpdateVertexBuffers();
+				const double mesh_time_ms = volume.GetMeshStats().mesh_time_ms;
+				if (run == 0 || mesh_time_ms < best_ms) {
+					best_ms = mesh_time_ms;
+				}
+			}
+			std::uint64_t hash = HashBuffers(volume);
+			if (thread_count == 1) {
+				serial_hash = hash;
+				serial_ms = best_ms;
+			}
+			const vv::MeshStats& stats = volume.GetMeshStats();
+			printf("%-16s %-7s %2zu threads %8zu chunks %9zu verts %9.3f ms %6.2fx  %016llx %s\n", name,
+				mode == vv::MESH_GREEDY ? "greedy" : "culled", thread_count, stats.chunks_meshed, stats.vertex_count,
+				best_ms, serial_ms / best_ms, static_cast<unsigned long long>(hash),
+				hash == serial_hash ? "" : "DIFFERS FROM SERIAL");
+			identical = identical && hash == serial_hash;
+		}
+		volume.SetMeshThreadCount(1);
+		return identical;
+	}
+
+	bool RunBoth(const char* name, BenchmarkVolume& volume) {
+		bool culled = Run(name, volume, vv::MESH_CULLED);
+		return Run(name, volume, vv::MESH_GREEDY) && culled;
+	}
+}
+
+// Returns 1 if any thread count builds different buffers than the serial path.
+int main() {
+	printf("%u hardware threads\n\n", std::thread::hardware_concurrency());
+	bool identical = true;
+
+	// A sphere, lots of chunks with a similar amount of work each.
+	{
+		BenchmarkVolume sphere;
+		sphere.FillSphere(0, 0, 0, 64);
+		identical = RunBoth("sphere r64", sphere) && identical;
+	}
+
+	// Height map terrain with a material per band of height, chunks vary a lot in work.
+	{
+		BenchmarkVolume terrain;
+		const vv::Voxel bands[3] = { vv::Voxel(0.4f, 0.3f, 0.2f), vv::Voxel(0.2f, 0.6f, 0.2f), vv::Voxel(0.9f, 0.9f, 0.9f) };
+		srand(7);
+		int height = 8;
+		for (short column = 0; column < 256; ++column) {
+			for (short slice = 0; slice < 256; ++slice) {
+				height += rand() % 3 - 1;
+				height = height < 1 ? 1 : (height > 24 ? 24 : height);
+				for (short row = 0; row < height; ++row) {
+					terrain.AddVoxel(row, column, slice, bands[row * 3 / 25]);
+				}
+			}
+		}
+		identical = RunBoth("terrain 256x256", terrain) && identical;
+	}
+
+	// Every other voxel solid, the most work per chunk.
+	{
+		BenchmarkVolume noise;
+		srand(7);
+		for (short row = 0; row < 64; ++row) {
+			for (short column = 0; column < 64; ++column) {
+				for (short slice = 0; slice < 64; ++slice) {
+					if (rand() % 2) {
+						noise.AddVoxel(row, column, slice);
+					}
+				}
+			}
+		}
+		identical = RunBoth("noise 64", noise) && identical;
+	}
+
+	return identical ? 0 : 1;
+}
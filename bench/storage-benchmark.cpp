@@ -0,0 +1,107 @@
+#include "voxelvolume.hpp"
+#include "vertexbuffer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Builds a sparse, a dense and a terrain scene with STORAGE_CHUNKS and STORAGE_OCTREE and reports the memory each
+// backend uses (from GetMemoryReport(), next to the per voxel hash map estimate) and the average IsSolid() latency of
+// random queries in a 1024^3 box around the scene.
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	// Exposes the protected edit functions so scenes can be built without going through the command queue.
+	class BenchmarkVolume : public vv::VoxelVolume {
+	public:
+		explicit BenchmarkVolume(const vv::VOXEL_STORAGE storage) : vv::VoxelVolume(storage) { }
+		using vv::VoxelVolume::AddVoxel;
+		using vv::VoxelVolume::FillBox;
+	};
+
+	const int QUERY_COUNT = 4000000;
+	const int QUERY_MIN = -512;
+	const int QUERY_SIZE = 1024;
+
+	// 20k voxels scattered through the query box.
+	void BuildSparse(BenchmarkVolume& volume) {
+		srand(11);
+		for (int voxel = 0; voxel < 20000; ++voxel) {
+			volume.AddVoxel(static_cast<short>(QUERY_MIN + rand() % QUERY_SIZE), static_cast<short>(QUERY_MIN + rand() % QUERY_SIZE),
+				static_cast<short>(QUERY_MIN + rand() % QUERY_SIZE));
+		}
+	}
+
+	// A solid 256x256x128 box.
+	void BuildDense(BenchmarkVolume& volume) {
+		const short min[3] = { 0, 0, 0 };
+		const short max[3] = { 127, 255, 255 };
+		volume.FillBox(min, max);
+	}
+
+	// A 512x512 height field with a material per band of height.
+	void BuildTerrain(BenchmarkVolume& volume) {
+		const vv::Voxel bands[3] = { vv::Voxel(0.4f, 0.3f, 0.2f), vv::Voxel(0.2f, 0.6f, 0.2f), vv::Voxel(0.9f, 0.9f, 0.9f) };
+		srand(7);
+		int height = 16;
+		for (short column = -256; column < 256; ++column) {
+			for (short slice = -256; slice < 256; ++slice) {
+				height += rand() % 3 - 1;
+				height = height < 1 ? 1 : (height > 48 ? 48 : height);
+				for (int band = 0; band < 3; ++band) {
+					short min[3] = { static_cast<short>(height * band / 3), column, slice };
+					short max[3] = { static_cast<short>(height * (band + 1) / 3 - 1), column, slice };
+					if (min[0] <= max[0]) {
+						volume.FillBox(min, max, bands[band]);
+					}
+				}
+			}
+		}
+	}
+
+	// Average nanoseconds per IsSolid() over the queries, the hit count keeps the calls from being optimized away.
+	double TimeIsSolid(const BenchmarkVolume& volume, const std::vector<short>& queries, size_t& hits) {
+		hits = 0;
+		Clock::time_point begin = Clock::now();
+		for (size_t query = 0; query < queries.size(); query += 3) {
+			hits += volume.IsSolid(queries[query], queries[query + 1], queries[query + 2]) ? 1 : 0;
+		}
+		double elapsed_ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+		return elapsed_ns / (queries.size() / 3);
+	}
+
+	void Run(const char* name, void (*build)(BenchmarkVolume&), const std::vector<short>& queries) {
+		const vv::VOXEL_STORAGE storages[] = { vv::STORAGE_CHUNKS, vv::STORAGE_OCTREE };
+		for (vv::VOXEL_STORAGE storage : storages) {
+			BenchmarkVolume volume(storage);
+			Clock::time_point begin = Clock::now();
+			build(volume);
+			double build_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+			size_t hits = 0;
+			double query_ns = TimeIsSolid(volume, queries, hits);
+
+			vv::VoxelMemoryReport report = volume.GetMemoryReport();
+			bool chunks = storage == vv::STORAGE_CHUNKS;
+			printf("%-8s %-6s %9zu voxels %10zu bytes %8.2f B/voxel (hash map %6.1f B/voxel) %9.1f ms build %6.1f ns/IsSolid %8zu hits\n",
+				name, chunks ? "chunks" : "octree", report.voxel_count, chunks ? report.chunk_bytes : report.octree_bytes,
+				chunks ? report.ChunkBytesPerVoxel() : report.OctreeBytesPerVoxel(), report.HashMapBytesPerVoxel(), build_ms,
+				query_ns, hits);
+		}
+	}
+}
+
+int main() {
+	std::vector<short> queries;
+	queries.reserve(QUERY_COUNT * 3);
+	srand(3);
+	for (int query = 0; query < QUERY_COUNT * 3; ++query) {
+		queries.push_back(static_cast<short>(QUERY_MIN + rand() % QUERY_SIZE));
+	}
+
+	Run("sparse", BuildSparse, queries);
+	Run("dense", BuildDense, queries);
+	Run("terrain", BuildTerrain, queries);
+	return 0;
+}
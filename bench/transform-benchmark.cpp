@@ -0,0 +1,264 @@
+#include "transform-store.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Times a full model matrix rebuild of 1k, 10k and 100k entities. The baseline is what RenderSystem did before
+// TransformStore: a heap allocated matrix per entity computed from its own transform, one entity at a time. The store
+// is timed with both of its kernels.
+//
+// Then times frames of reparenting in a few hierarchies: 1% of the entities get a new parent, then every world matrix
+// is brought up to date. The baseline keeps a child list per entity and recomputes the world matrices recursively from
+// the tops.
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entity {
+		glm::vec3 translation;
+		glm::quat orientation;
+		glm::vec3 scale;
+	};
+
+	float RandomUnit() {
+		return rand() / static_cast<float>(RAND_MAX) * 2.0f - 1.0f;
+	}
+
+	Entity RandomEntity() {
+		Entity entity;
+		entity.translation = glm::vec3(RandomUnit() * 100.0f, RandomUnit() * 100.0f, RandomUnit() * 100.0f);
+		entity.orientation = glm::normalize(glm::quat(RandomUnit(), RandomUnit(), RandomUnit(), RandomUnit()));
+		entity.scale = glm::vec3(RandomUnit() + 2.0f, RandomUnit() + 2.0f, RandomUnit() + 2.0f);
+		return entity;
+	}
+
+	// Microseconds per rebuild with a matrix per entity.
+	double TimePerEntity(const std::vector<Entity>& entities, const int runs) {
+		std::vector<std::shared_ptr<Entity>> transforms;
+		std::vector<std::shared_ptr<glm::mat4>> matrices;
+		for (const Entity& entity : entities) {
+			transforms.push_back(std::make_shared<Entity>(entity));
+			matrices.push_back(std::make_shared<glm::mat4>());
+		}
+		Clock::time_point begin = Clock::now();
+		for (int run = 0; run < runs; ++run) {
+			for (size_t index = 0; index < entities.size(); ++index) {
+				const Entity& entity = *transforms[index];
+				*matrices[index] = glm::scale(glm::translate(glm::mat4(1.0f), entity.translation) *
+					glm::mat4_cast(entity.orientation), entity.scale);
+			}
+		}
+		double elapsed_us = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+		volatile float sink = (*matrices[0])[0][0];
+		(void)sink;
+		return elapsed_us / runs;
+	}
+
+	// Microseconds per UpdateModelMatrices() with every entity changed, Set() isn't timed.
+	double TimeStore(const std::vector<Entity>& entities, const int runs, const vv::MATRIX_KERNEL kernel) {
+		vv::TransformStore store;
+		store.SetKernel(kernel);
+		double elapsed_us = 0.0;
+		for (int run = 0; run < runs; ++run) {
+			for (size_t index = 0; index < entities.size(); ++index) {
+				const Entity& entity = entities[index];
+				store.Set(index + 1, entity.translation, entity.orientation, entity.scale);
+			}
+			Clock::time_point begin = Clock::now();
+			store.UpdateModelMatrices();
+			elapsed_us += std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+		}
+		return elapsed_us / runs;
+	}
+
+	const vv::GUID NO_PARENT = 0;
+
+	// A new parent for an entity.
+	struct Move {
+		size_t entity;
+		vv::GUID parent; // Entity index + 1, or NO_PARENT.
+	};
+
+	// The starting parent of each entity (entity index + 1, or NO_PARENT) and frames of moves that keep it a forest.
+	struct Hierarchy {
+		std::vector<vv::GUID> parents;
+		std::vector<std::vector<Move>> frames;
+	};
+
+	bool IsAncestor(const std::vector<vv::GUID>& parents, const size_t ancestor, size_t entity) {
+		for (vv::GUID parent = parents[entity]; parent != NO_PARENT; parent = parents[parent - 1]) {
+			if (static_cast<size_t>(parent - 1) == ancestor) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Picks moves_per_frame moves a frame. pick(parents, entity) returns a candidate parent, which is skipped if it would
+	// make a cycle or is already the parent.
+	template <typename Pick>
+	Hierarchy MakeHierarchy(std::vector<vv::GUID> parents, const int frames, const size_t moves_per_frame, Pick pick) {
+		Hierarchy hierarchy;
+		hierarchy.parents = parents;
+		for (int frame = 0; frame < frames; ++frame) {
+			std::vector<Move> moves;
+			while (moves.size() < moves_per_frame) {
+				size_t entity = rand() % parents.size();
+				vv::GUID parent = pick(parents, entity);
+				if (parent == parents[entity] || (parent != NO_PARENT && (static_cast<size_t>(parent - 1) == entity ||
+					IsAncestor(parents, entity, parent - 1)))) {
+					continue;
+				}
+				parents[entity] = parent;
+				Move move = { entity, parent };
+				moves.push_back(move);
+			}
+			hierarchy.frames.push_back(moves);
+		}
+		return hierarchy;
+	}
+
+	struct TreeNode {
+		Entity entity;
+		vv::GUID parent;
+		std::vector<size_t> children;
+		glm::mat4 world;
+	};
+
+	void UpdateRecursive(std::vector<TreeNode>& nodes, const size_t index, const glm::mat4& parent_world) {
+		TreeNode& node = nodes[index];
+		node.world = parent_world * glm::scale(glm::translate(glm::mat4(1.0f), node.entity.translation) *
+			glm::mat4_cast(node.entity.orientation), node.entity.scale);
+		for (size_t child : node.children) {
+			UpdateRecursive(nodes, child, node.world);
+		}
+	}
+
+	// Milliseconds per frame of relinking child lists and recomputing every world matrix.
+	double TimeReparentRecursive(const std::vector<Entity>& entities, const Hierarchy& hierarchy) {
+		std::vector<TreeNode> nodes(entities.size());
+		for (size_t index = 0; index < entities.size(); ++index) {
+			nodes[index].entity = entities[index];
+			nodes[index].parent = hierarchy.parents[index];
+			if (hierarchy.parents[index] != NO_PARENT) {
+				nodes[hierarchy.parents[index] - 1].children.push_back(index);
+			}
+		}
+		const glm::mat4 identity(1.0f);
+		Clock::time_point begin = Clock::now();
+		for (const std::vector<Move>& moves : hierarchy.frames) {
+			for (const Move& move : moves) {
+				TreeNode& node = nodes[move.entity];
+				if (node.parent != NO_PARENT) {
+					std::vector<size_t>& siblings = nodes[node.parent - 1].children;
+					siblings.erase(std::find(siblings.begin(), siblings.end(), move.entity));
+				}
+				node.parent = move.parent;
+				if (move.parent != NO_PARENT) {
+					nodes[move.parent - 1].children.push_back(move.entity);
+				}
+			}
+			for (size_t index = 0; index < nodes.size(); ++index) {
+				if (nodes[index].parent == NO_PARENT) {
+					UpdateRecursive(nodes, index, identity);
+				}
+			}
+		}
+		double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+		volatile float sink = nodes.back().world[3][0];
+		(void)sink;
+		return elapsed_ms / hierarchy.frames.size();
+	}
+
+	// Milliseconds per frame of SetParent() for each move and UpdateModelMatrices().
+	double TimeReparentStore(const std::vector<Entity>& entities, const Hierarchy& hierarchy) {
+		vv::TransformStore store;
+		for (size_t index = 0; index < entities.size(); ++index) {
+			store.Set(index + 1, entities[index].translation, entities[index].orientation, entities[index].scale);
+			store.SetParent(index + 1, hierarchy.parents[index]);
+		}
+		store.UpdateModelMatrices();
+		Clock::time_point begin = Clock::now();
+		for (const std::vector<Move>& moves : hierarchy.frames) {
+			for (const Move& move : moves) {
+				store.SetParent(move.entity + 1, move.parent);
+			}
+			store.UpdateModelMatrices();
+		}
+		double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+		volatile float sink = (*store.GetModelMatrix(entities.size()))[3][0];
+		(void)sink;
+		return elapsed_ms / hierarchy.frames.size();
+	}
+
+	void RunReparent(const char* name, const std::vector<vv::GUID>& parents, const Hierarchy& hierarchy) {
+		std::vector<Entity> entities(parents.size());
+		for (Entity& entity : entities) {
+			entity = RandomEntity();
+		}
+		printf("%-22s %9zu %12.3fms %12.3fms\n", name, parents.size(), TimeReparentRecursive(entities, hierarchy),
+			TimeReparentStore(entities, hierarchy));
+	}
+}
+
+int main() {
+	srand(1);
+	printf("%9s %14s %14s %14s\n", "entities", "per entity", "store scalar", "store sse");
+	const size_t counts[] = { 1000, 10000, 100000 };
+	for (size_t count : counts) {
+		std::vector<Entity> entities(count);
+		for (Entity& entity : entities) {
+			entity = RandomEntity();
+		}
+		const int runs = std::max(5, static_cast<int>(2000000 / count));
+		printf("%9zu %12.1fus %12.1fus %12.1fus\n", count, TimePerEntity(entities, runs),
+			TimeStore(entities, runs, vv::MATRIX_KERNEL_SCALAR), TimeStore(entities, runs, vv::MATRIX_KERNEL_SSE));
+	}
+
+	const int frames = 20;
+	printf("\n%-22s %9s %14s %14s\n", "reparent 1% per frame", "entities", "recursive", "store");
+	const size_t tree_counts[] = { 10000, 100000 };
+	for (size_t count : tree_counts) {
+		// A 4 wide tree, moves pick any entity as the new parent, so whole subtrees move.
+		std::vector<vv::GUID> parents(count);
+		for (size_t index = 0; index < count; ++index) {
+			parents[index] = index ? (index - 1) / 4 + 1 : NO_PARENT;
+		}
+		Hierarchy tree = MakeHierarchy(parents, frames, count / 100, [count] (const std::vector<vv::GUID>&, size_t) {
+			return static_cast<vv::GUID>(rand() % count + 1);
+		});
+		RunReparent("tree 4 wide", parents, tree);
+
+		// Every entity under one of two tops, moves swap a leaf to the other top.
+		for (size_t index = 0; index < count; ++index) {
+			parents[index] = index < 2 ? NO_PARENT : index % 2 + 1;
+		}
+		Hierarchy flat = MakeHierarchy(parents, frames, count / 100, [] (const std::vector<vv::GUID>& current, size_t entity) {
+			return entity < 2 ? current[entity] : static_cast<vv::GUID>(3 - current[entity]);
+		});
+		RunReparent("flat", parents, flat);
+	}
+
+	// A single chain, moves hang an entity (and everything below it) off a random entity above it.
+	{
+		const size_t count = 2000;
+		std::vector<vv::GUID> parents(count);
+		for (size_t index = 0; index < count; ++index) {
+			parents[index] = index;
+		}
+		Hierarchy chain = MakeHierarchy(parents, frames, count / 100, [] (const std::vector<vv::GUID>& current, size_t entity) {
+			std::vector<vv::GUID> ancestors;
+			for (vv::GUID parent = current[entity]; parent != NO_PARENT; parent = current[parent - 1]) {
+				ancestors.push_back(parent);
+			}
+			return ancestors.empty() ? NO_PARENT : ancestors[rand() % ancestors.size()];
+		});
+		RunReparent("deep chain", parents, chain);
+	}
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include "voxel-volume-manager.hpp"
+#include "vertexbuffer.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <tuple>
+
+// Sweeps VoxelVolumeManager over 1 to 64 volumes and 1 to 8 update threads. Each frame every volume gets the same
+// number of edits, queued interleaved across the volumes, and the routed commands per second of Update() (which
+// includes remeshing) are reported. Before the sweep, the buffers each managed volume ends up with are checked against a
+// volume that only ever saw its own commands.
+
+namespace {
+	const int COMMANDS_PER_VOLUME = 2000;
+	const int FRAMES = 5;
+	const vv::GUID FIRST_ENTITY_ID = 100;
+
+	// A small integer hash, so each entity's edit sequence can be regenerated on its own.
+	unsigned int Mix(unsigned int value) {
+		value ^= value >> 16;
+		value *= 0x7feb352d;
+		value ^= value >> 15;
+		value *= 0x846ca68b;
+		value ^= value >> 16;
+		return value;
+	}
+
+	// Queues edit number sequence of an entity: mostly adds in a 32^3 region, some removes and the odd box.
+	void QueueEdit(const vv::GUID entity_id, const unsigned int sequence) {
+		unsigned int random = Mix(static_cast<unsigned int>(entity_id) * 2654435761u + sequence);
+		short row = static_cast<short>(random & 31);
+		short column = static_cast<short>((random >> 5) & 31);
+		short slice = static_cast<short>((random >> 10) & 31);
+		vv::Voxel material(((random >> 15) & 3) / 3.0f, 0.5f, ((random >> 17) & 3) / 3.0f);
+		unsigned int kind = (random >> 19) % 100;
+		if (kind < 70) {
+			vv::VoxelVolume::QueueCommand<vv::VoxelCommand>(vv::VOXEL_ADD, entity_id,
+				std::make_tuple(row, column, slice, material));
+		}
+		else if (kind < 98) {
+			vv::VoxelVolume::QueueCommand<vv::VoxelCommand>(vv::VOXEL_REMOVE, entity_id, std::make_tuple(row, column, slice));
+		}
+		else {
+			vv::VoxelVolume::QueueCommand<vv::VoxelBoxCommand>(vv::VOXEL_FILL_BOX, entity_id,
+				std::make_tuple(row, column, slice, static_cast<short>(row + 3), static_cast<short>(column + 3),
+					static_cast<short>(slice + 3), material));
+		}
+	}
+
+	// Queues a frame of edits for volume_count entities, one edit per entity in turn.
+	void QueueFrame(const size_t volume_count, const int frame) {
+		for (int command = 0; command < COMMANDS_PER_VOLUME; ++command) {
+			for (size_t volume = 0; volume < volume_count; ++volume) {
+				QueueEdit(FIRST_ENTITY_ID + volume, frame * COMMANDS_PER_VOLUME + command);
+			}
+		}
+	}
+
+	// FNV-1a over a volume's vertex and index buffers.
+	std::uint64_t HashBuffers(vv::VoxelVolume& volume) {
+		std::uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash] (const void* data, const size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+		const std::vector<vv::PackedVertex>& verts = volume.GetVertexBuffer();
+		const std::vector<unsigned int>& indicies = volume.GetIndexBuffer();
+		if (!verts.empty()) {
+			add(&verts[0], verts.size() * sizeof(vv::PackedVertex));
+		}
+		if (!indicies.empty()) {
+			add(&indicies[0], indicies.size() * sizeof(unsigned int));
+		}
+		return hash;
+	}
+
+	// Returns false if any managed volume's buffers differ from a volume that only ran its own commands.
+	bool CheckRouting(const size_t volume_count, const size_t thread_count) {
+		vv::VoxelVolumeManager manager(thread_count);
+		for (size_t volume = 0; volume < volume_count; ++volume) {
+			manager.AddVolume(FIRST_ENTITY_ID + volume);
+		}
+		for (int frame = 0; frame < FRAMES; ++frame) {
+			QueueFrame(volume_count, frame);
+			manager.Update(0.0);
+		}
+
+		bool identical = true;
+		for (size_t volume = 0; volume < volume_count; ++volume) {
+			const vv::GUID entity_id = FIRST_ENTITY_ID + volume;
+			vv::VoxelVolume own;
+			for (int frame = 0; frame < FRAMES; ++frame) {
+				for (int command = 0; command < COMMANDS_PER_VOLUME; ++command) {
+					QueueEdit(entity_id, frame * COMMANDS_PER_VOLUME + command);
+				}
+				own.Update(0.0);
+			}
+			if (HashBuffers(*manager.GetVolume(entity_id)) != HashBuffers(own) ||
+				manager.GetVolume(entity_id)->GetVoxelCount() != own.GetVoxelCount()) {
+				printf("volume %zu of %zu (%zu threads) differs from its own commands\n", volume, volume_count, thread_count);
+				identical = false;
+			}
+		}
+		printf("routed vs own commands, %zu volumes %zu threads: %s\n", volume_count, thread_count,
+			identical ? "identical" : "DIFFERENT");
+		return identical;
+	}
+
+	void Run(const size_t volume_count, const size_t thread_count) {
+		vv::VoxelVolumeManager manager(thread_count);
+		for (size_t volume = 0; volume < volume_count; ++volume) {
+			manager.AddVolume(FIRST_ENTITY_ID + volume);
+		}
+		double total_commands_per_second = 0.0, total_ms = 0.0;
+		for (int frame = 0; frame < FRAMES; ++frame) {
+			QueueFrame(volume_count, frame);
+			manager.Update(0.0);
+			total_commands_per_second += manager.GetUpdateStats().CommandsPerSecond();
+			total_ms += manager.GetUpdateStats().update_time_ms;
+		}
+		printf("%4zu volumes %2zu threads %9.3f ms/update %8.3f M commands/s\n", volume_count, thread_count,
+			total_ms / FRAMES, total_commands_per_second / FRAMES / 1e6);
+	}
+}
+
+// Returns 1 if routing changed any volume's buffers.
+int main() {
+	bool identical = CheckRouting(8, 1);
+	identical = CheckRouting(8, 4) && identical;
+	printf("\n");
+
+	const size_t volume_counts[] = { 1, 4, 16, 64 };
+	const size_t thread_counts[] = { 1, 2, 4, 8 };
+	for (size_t volume_count : volume_counts) {
+		for (size_t thread_count : thread_counts) {
+			Run(volume_count, thread_count);
+		}
+	}
+	return identical ? 0 : 1;
+}
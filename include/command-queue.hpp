@@ -1,9 +1,12 @@
 #pragma once
 
-#include <queue>
-#include <memory>
-#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
 #include "multiton.hpp"
+#include "mpsc-queue.hpp"
 
 namespace vv {
 	// Base class used for commands. T is the command id type (e.g. enum, int, char).
@@ -14,26 +17,193 @@ namespace vv {
 		GUID entity_id;
 	};
 
+	/* Finds the commands in a batch that a later command makes redundant.
+	*
+	* Each command is recorded with its position in the batch and a key for
+	* the state it touches (an entity, a voxel). A command is dropped when the
+	* next command recorded for the same key is of the same kind, since
+	* running both has the same effect as running only the last one. Barriers
+	* are commands that can't be coalesced, nothing on their key is coalesced
+	* across them. Commands on different keys are assumed to commute.
+	*/
+	class CommandCoalescer {
+	public:
+		// Forgets the previous batch.
+		void Begin() {
+			this->entries.clear();
+			this->dropped.clear();
+		}
+
+		// Records that the command at index may be replaced by a later command of the same kind on key.
+		void Add(const std::uint64_t key, const int kind, const size_t index) {
+			Entry entry = { key, index, kind };
+			this->entries.push_back(entry);
+		}
+
+		// Records a command at index that doesn't commute with the other commands on key.
+		void AddBarrier(const std::uint64_t key, const size_t index) {
+			Add(key, BARRIER, index);
+		}
+
+		// Marks the redundant commands among those recorded since the last call. Returns how many were marked.
+		size_t Resolve() {
+			std::sort(this->entries.begin(), this->entries.end(), [] (const Entry& a, const Entry& b) {
+				return a.key < b.key || (a.key == b.key && a.index < b.index);
+			});
+			size_t count = 0;
+			for (size_t i = 0; i + 1 < this->entries.size(); ++i) {
+				const Entry& entry = this->entries[i];
+				const Entry& next = this->entries[i + 1];
+				if (entry.kind != BARRIER && next.key == entry.key && next.kind == entry.kind) {
+					if (this->dropped.size() <= entry.index) {
+						this->dropped.resize(entry.index + 1, false);
+					}
+					this->dropped[entry.index] = true;
+					++count;
+				}
+			}
+			this->entries.clear();
+			return count;
+		}
+
+		bool IsDropped(const size_t index) const {
+			return index < this->dropped.size() && this->dropped[index];
+		}
+	private:
+		static const int BARRIER = -1;
+
+		struct Entry {
+			std::uint64_t key;
+			size_t index;
+			int kind;
+		};
+
+		std::vector<Entry> entries;
+		std::vector<bool> dropped;
+	};
+
+	// Counts from a single round of command processing.
+	struct CommandStats {
+		CommandStats() : processed(0), deferred(0), process_time_us(0.0) { }
+		size_t processed; // Commands run or dropped by coalescing.
+		size_t deferred; // Commands left queued for the next round because the budget ran out.
+		double process_time_us;
+	};
+
 	// T is the command id type (e.g. enum, int, char), and U is the derived command type.
+	// Commands may be queued from any thread, the derived class drains them on its own thread.
 	template <class T>
 	class CommandQueue {
 	public:
-		CommandQueue() :
-			local_queue(new std::queue<std::shared_ptr<Command<T>>>()) { }
+		CommandQueue() : coalesce_commands(false), dropped_commands(0), command_budget_us(0.0) { }
 		~CommandQueue() { }
 
+		// Commands are constructed in place in the queue, U must derive from Command<T>.
 		template <typename U, typename V>
 		static void QueueCommand(const T c, const GUID entity_id, V data = nullptr) {
-			auto command = std::make_shared<U>(c, entity_id, data);
-			(*global_queue).push(command);
+			global_queue.template Emplace<U>(c, entity_id, data);
 		}
 
 		static void QueueCommand(const T c, const GUID entity_id) {
-			auto command = std::make_shared<Command<T>>(c, entity_id);
-			(*global_queue).push(command);
+			global_queue.template Emplace<Command<T>>(c, entity_id);
+		}
+
+		// Enables dropping queued commands that a later command in the same batch makes redundant. Off by default.
+		void SetCommandCoalescing(const bool coalesce) {
+			this->coalesce_commands = coalesce;
+		}
+
+		bool IsCommandCoalescing() const {
+			return this->coalesce_commands;
+		}
+
+		// Returns the number of commands dropped by coalescing so far.
+		size_t GetDroppedCommandCount() const {
+			return this->dropped_commands;
+		}
+
+		// Limits how long each round of command processing may run, the commands that don't fit are deferred to the next
+		// round. Urgent commands (like camera updates) always run. 0 (the default) runs every queued command.
+		void SetCommandBudget(const double budget_us) {
+			this->command_budget_us = budget_us;
+		}
+
+		double GetCommandBudget() const {
+			return this->command_budget_us;
+		}
+
+		// Returns the counts from the last round of command processing.
+		const CommandStats& GetCommandStats() const {
+			return this->command_stats;
+		}
+
+		// Returns the number of storage segments the command queue has allocated, constant once it reaches steady state.
+		static size_t GetQueueAllocations() {
+			return global_queue.GetSegmentAllocations();
 		}
 	protected:
-		static std::atomic<std::queue<std::shared_ptr<Command<T>>>*> global_queue;
-		std::queue<std::shared_ptr<Command<T>>>* local_queue;
+		/**
+		* \brief Runs commands found by peeking global_queue and releases each one it runs from the queue.
+		*
+		* The urgent commands run first, then the rest in order until the command budget is used up. At least one
+		* command runs each round so a slow command can't stall the queue. Urgent commands must not depend on the
+		* others, since they can overtake them. Commands the coalescer dropped are released without running.
+		* \param[in] const std::vector<Command<T>*>& commands The peeked commands, in queue order.
+		* \param[in] IsUrgent is_urgent Returns true for a Command<T>* that should run whatever the budget.
+		* \param[in] Run run Called with the Command<T>* to run.
+		* \return void
+		*/
+		template <typename IsUrgent, typename Run>
+		void RunCommands(const std::vector<Command<T>*>& commands, IsUrgent is_urgent, Run run) {
+			auto start_time = std::chrono::steady_clock::now();
+			this->command_stats = CommandStats();
+
+			for (size_t index = 0; index < commands.size(); ++index) {
+				if (is_urgent(commands[index])) {
+					if (!this->coalescer.IsDropped(index)) {
+						run(commands[index]);
+					}
+					global_queue.Release(commands[index]);
+					++this->command_stats.processed;
+				}
+			}
+
+			bool out_of_time = false;
+			size_t ran = 0;
+			for (size_t index = 0; index < commands.size(); ++index) {
+				Command<T>* action = commands[index];
+				if (is_urgent(action)) {
+					continue;
+				}
+				if (!out_of_time && ran > 0 && this->command_budget_us > 0.0) {
+					out_of_time = std::chrono::duration<double, std::micro>(
+						std::chrono::steady_clock::now() - start_time).count() >= this->command_budget_us;
+				}
+				if (out_of_time) {
+					++this->command_stats.deferred;
+					continue;
+				}
+				if (!this->coalescer.IsDropped(index)) {
+					run(action);
+					++ran;
+				}
+				global_queue.Release(action);
+				++this->command_stats.processed;
+			}
+
+			this->command_stats.process_time_us = std::chrono::duration<double, std::micro>(
+				std::chrono::steady_clock::now() - start_time).count();
+		}
+
+		static MPSCQueue<Command<T>> global_queue;
+		bool coalesce_commands;
+		size_t dropped_commands;
+		CommandCoalescer coalescer; // Reused by each ProcessCommandQueue() so coalescing doesn't allocate once warmed up.
+		std::vector<Command<T>*> pending_commands; // Commands peeked from global_queue, reused by each round.
+		double command_budget_us;
+		CommandStats command_stats;
 	};
+
+	template <class T>
+	MPSCQueue<Command<T>> CommandQueue<T>::global_queue;
 }
@@ -1,9 +1,10 @@
 #pragma once
 
-#include <list>
-#include <map>
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "multiton.hpp"
 
@@ -16,14 +17,38 @@ namespace vv {
 		virtual void Notify(const T* data) { }
 		virtual void Notify(const GUID entity_id, const T data) { }
 		virtual void Notify(const T data) { }
+
+		// Called instead of the Notify() overloads for subscribers that return true from IsBatched(). Delivers a span
+		// of events, with entity_ids[i] the entity events[i] was sent to (0 if it wasn't sent to a specific entity).
+		// Immediate notifications arrive as a span of one, deferred ones as every event since the last delivery.
+		virtual void NotifyBatch(const GUID* entity_ids, const T* events, const size_t count) { }
+
+		// Checked once when subscribing.
+		virtual bool IsBatched() const {
+			return false;
+		}
 	};
 
-	// Dispatches data change notifications to the various subscribers.
+	/* Dispatches data change notifications to the various subscribers.
+	*
+	* The subscriptions are kept in a flat table sorted by entity ID that is
+	* never modified once published. Subscribing or unsubscribing copies the
+	* table under a lock and swaps the copy in, so notifying is a binary
+	* search and a walk over contiguous memory that never allocates or locks,
+	* and is safe from any thread. A notification in progress keeps using the
+	* table it started with. Replaced tables are freed once no notification
+	* is reading them.
+	*
+	* In deferred mode notifying only copies the event into a buffer, and
+	* DeliverEvents() delivers everything buffered since its last call in
+	* one go, so a storm of events (like mouse moves) costs one batched call
+	* per subscriber instead of one call per event.
+	*/
 	template <typename T>
 	class Dispatcher final {
 	private:
-		Dispatcher() { }
-		Dispatcher(const Dispatcher& right) {
+		Dispatcher() : table(new SubscriptionTable()), readers(0), deferred(false) { }
+		Dispatcher(const Dispatcher& right) : table(new SubscriptionTable()), readers(0), deferred(false) {
 			instance = right.instance;
 		}
 		Dispatcher& operator=(const Dispatcher& right) {
@@ -45,7 +70,12 @@ namespace vv {
 
 			return Dispatcher<T>::instance;
 		}
-		~Dispatcher() { }
+		~Dispatcher() {
+			delete this->table.load();
+			for (const SubscriptionTable* retired_table : this->retired) {
+				delete retired_table;
+			}
+		}
 
 		/**
 		 * \brief Subscribes to be notified of data change events.
@@ -55,21 +85,17 @@ namespace vv {
 		 * \return void
 		 */
 		void Subscribe(const GUID entity_id, Subscriber<T>* subscriber) {
-			auto sube = this->subcriberss.find(entity_id);
-			if (sube == this->subcriberss.end()) {
-				// no subscriptions for entity, add the entity and subscriber
-				this->subcriberss[entity_id].push_back(subscriber);
-				return;
-			}
-			else {
-				// check if subscriber already exists
-				for (auto sub : sube->second) {
-					if (sub == subscriber) {
-						return; // already subscribed
+			UpdateTable([entity_id, subscriber] (SubscriptionTable& subscriptions) {
+				auto range = std::equal_range(subscriptions.begin(), subscriptions.end(), Subscription(entity_id, nullptr));
+				for (auto sub = range.first; sub != range.second; ++sub) {
+					if (sub->subscriber == subscriber) {
+						return false; // already subscribed
 					}
 				}
-				sube->second.push_back(subscriber);
-			}
+				// Inserted after the entity's existing subscribers so they are notified in subscription order.
+				subscriptions.insert(range.second, Subscription(entity_id, subscriber, subscriber->IsBatched()));
+				return true;
+			});
 		}
 
 		/**
@@ -79,7 +105,7 @@ namespace vv {
 		 * \return void
 		 */
 		void Subscribe(Subscriber<T>* subscriber) {
-			this->subcriberss[0].push_back(subscriber);
+			Subscribe(0, subscriber);
 		}
 
 		/**
@@ -90,9 +116,16 @@ namespace vv {
 		 * \return void
 		 */
 		void Unsubscribe(const GUID entity_id, Subscriber<T>* subscriber) {
-			if (this->subcriberss.find(entity_id) != this->subcriberss.end()) {
-				this->subcriberss[entity_id].remove(subscriber);
-			}
+			UpdateTable([entity_id, subscriber] (SubscriptionTable& subscriptions) {
+				auto removed = std::remove_if(subscriptions.begin(), subscriptions.end(), [entity_id, subscriber] (const Subscription& sub) {
+					return sub.entity_id == entity_id && sub.subscriber == subscriber;
+				});
+				if (removed == subscriptions.end()) {
+					return false;
+				}
+				subscriptions.erase(removed, subscriptions.end());
+				return true;
+			});
 		}
 
 		/**
@@ -102,73 +135,289 @@ namespace vv {
 		 * \return void
 		 */
 		void Unsubscribe(Subscriber<T>* subscriber) {
-			if (this->subcriberss.find(0) != this->subcriberss.end()) {
-				this->subcriberss[0].remove(subscriber);
-			}
+			Unsubscribe(0, subscriber);
 		}
 
 		/**
 		 * \brief Called to notify all subscribers that the data has changed.
 		 *
 		 * \param const unsigned int entity_id ID of the entity to update.
-		 * \param const T* data The changed data.
+		 * \param const T* data The changed data, copied if the dispatcher is deferred.
 		 * \return void
 		 */
 		void NotifySubscribers(const GUID entity_id, const T* data) {
-			if (this->subcriberss.find(entity_id) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(entity_id);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(entity_id, data);
-				}
-			}
-
-			if (this->subcriberss.find(0) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(0);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(entity_id, data);
-				}
+			if (this->deferred.load(std::memory_order_relaxed)) {
+				QueueEvent(entity_id, *data, TO_ENTITY);
+				return;
 			}
+			NotifyNow(entity_id, data);
 		}
 		void NotifySubscribers(const GUID entity_id, const T data) {
-			if (this->subcriberss.find(entity_id) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(entity_id);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(entity_id, data);
-				}
-			}
-
-			if (this->subcriberss.find(0) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(0);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(entity_id, data);
-				}
+			if (this->deferred.load(std::memory_order_relaxed)) {
+				QueueEvent(entity_id, data, TO_ENTITY | BY_VALUE);
+				return;
 			}
+			NotifyNow(entity_id, data);
 		}
 
 		/**
 		 * \brief Called to notify all subscribers for entity ID 0 that the data has changed.
 		 *
-		 * \param const T* data The changed data.
+		 * \param const T* data The changed data, copied if the dispatcher is deferred.
 		 * \return void
 		 */
 		void NotifySubscribers(const T* data) {
-			if (this->subcriberss.find(0) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(0);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(data);
-				}
+			if (this->deferred.load(std::memory_order_relaxed)) {
+				QueueEvent(0, *data, 0);
+				return;
 			}
+			NotifyNow(data);
 		}
 		void NotifySubscribers(const T data) {
-			if (this->subcriberss.find(0) != this->subcriberss.end()) {
-				auto subscriber_list = this->subcriberss.at(0);
-				for (Subscriber<T>* subscriber : subscriber_list) {
-					subscriber->Notify(data);
+			if (this->deferred.load(std::memory_order_relaxed)) {
+				QueueEvent(0, data, BY_VALUE);
+				return;
+			}
+			NotifyNow(data);
+		}
+
+		// Sets whether notifications are buffered until DeliverEvents() instead of delivered right away. Off by default.
+		// Turning it off doesn't deliver the events already buffered.
+		void SetDeferred(const bool defer) {
+			this->deferred.store(defer);
+		}
+
+		bool IsDeferred() const {
+			return this->deferred.load();
+		}
+
+		/**
+		 * \brief Delivers the events buffered in deferred mode, in the order they were sent.
+		 *
+		 * Each event goes to the regular subscribers as it would have right away, then every batched subscriber is
+		 * called once with all of its events. Events sent while delivering are buffered for the next call. Call from
+		 * one thread at a time, not from a subscriber.
+		 * \return size_t The number of events delivered.
+		 */
+		size_t DeliverEvents() {
+			{
+				std::lock_guard<std::mutex> lock(this->queue_mutex);
+				this->delivering.Swap(this->queued);
+			}
+			EventBuffer& events = this->delivering;
+			const size_t count = events.events.size();
+			if (count == 0) {
+				return 0;
+			}
+
+			this->readers.fetch_add(1);
+			const SubscriptionTable* subscriptions = this->table.load();
+			bool batched_entities = false;
+			for (const Subscription& sub : *subscriptions) {
+				batched_entities = batched_entities || (sub.batched && sub.entity_id != 0);
+			}
+
+			for (size_t index = 0; index < count; ++index) {
+				const GUID entity_id = events.entity_ids[index];
+				const T& data = events.events[index];
+				const unsigned char form = events.forms[index];
+				auto notify = [entity_id, &data, form] (const Subscription& sub) {
+					if (sub.batched) {
+						return;
+					}
+					if (!(form & TO_ENTITY)) {
+						if (form & BY_VALUE) {
+							sub.subscriber->Notify(data);
+						}
+						else {
+							sub.subscriber->Notify(&data);
+						}
+					}
+					else if (form & BY_VALUE) {
+						sub.subscriber->Notify(entity_id, data);
+					}
+					else {
+						sub.subscriber->Notify(entity_id, &data);
+					}
+				};
+				if (form & TO_ENTITY) {
+					VisitRange(*subscriptions, entity_id, notify);
+				}
+				if (!(form & TO_ENTITY) || entity_id != 0) {
+					VisitRange(*subscriptions, 0, notify);
 				}
 			}
+
+			// Subscribers to every entity get the whole buffer.
+			VisitRange(*subscriptions, 0, [&events, count] (const Subscription& sub) {
+				if (sub.batched) {
+					sub.subscriber->NotifyBatch(&events.entity_ids[0], &events.events[0], count);
+				}
+			});
+
+			// Per entity subscribers get only their entity's events, so group them by entity keeping their order.
+			if (batched_entities) {
+				this->order.clear();
+				for (size_t index = 0; index < count; ++index) {
+					if ((events.forms[index] & TO_ENTITY) && events.entity_ids[index] != 0) {
+						this->order.push_back(index);
+					}
+				}
+				std::sort(this->order.begin(), this->order.end(), [&events] (const size_t a, const size_t b) {
+					return events.entity_ids[a] < events.entity_ids[b] || (events.entity_ids[a] == events.entity_ids[b] && a < b);
+				});
+				EventBuffer& grouped = this->grouped;
+				grouped.Clear();
+				for (size_t index : this->order) {
+					grouped.Push(events.entity_ids[index], events.events[index], events.forms[index]);
+				}
+				for (size_t first = 0; first < grouped.events.size();) {
+					size_t last = first;
+					while (last < grouped.events.size() && grouped.entity_ids[last] == grouped.entity_ids[first]) {
+						++last;
+					}
+					VisitRange(*subscriptions, grouped.entity_ids[first], [&grouped, first, last] (const Subscription& sub) {
+						if (sub.batched) {
+							sub.subscriber->NotifyBatch(&grouped.entity_ids[first], &grouped.events[first], last - first);
+						}
+					});
+					first = last;
+				}
+			}
+			this->readers.fetch_sub(1);
+
+			events.Clear();
+			return count;
 		}
 	private:
-		std::map<GUID, std::list<Subscriber<T>*>> subcriberss;
+		struct Subscription {
+			Subscription(const GUID entity_id, Subscriber<T>* subscriber, const bool batched = false) :
+				entity_id(entity_id), subscriber(subscriber), batched(batched) { }
+			bool operator<(const Subscription& other) const {
+				return this->entity_id < other.entity_id;
+			}
+			GUID entity_id; // 0 for subscribers to every entity.
+			Subscriber<T>* subscriber;
+			bool batched; // The subscriber's IsBatched() when it subscribed.
+		};
+		typedef std::vector<Subscription> SubscriptionTable;
+
+		// Flags recording which NotifySubscribers() overload sent a deferred event.
+		static const unsigned char TO_ENTITY = 1; // Sent to an entity ID, subscribers get Notify(entity_id, ...).
+		static const unsigned char BY_VALUE = 2; // Sent by value, subscribers get the T rather than the T* overload.
+
+		// Events in the order they were sent, each as its entity ID, a copy of the data and its TO_ENTITY/BY_VALUE flags.
+		struct EventBuffer {
+			void Push(const GUID entity_id, const T& data, const unsigned char form) {
+				this->entity_ids.push_back(entity_id);
+				this->events.push_back(data);
+				this->forms.push_back(form);
+			}
+			void Swap(EventBuffer& other) {
+				this->entity_ids.swap(other.entity_ids);
+				this->events.swap(other.events);
+				this->forms.swap(other.forms);
+			}
+			// Keeps the allocations so a buffer in steady use stops allocating.
+			void Clear() {
+				this->entity_ids.clear();
+				this->events.clear();
+				this->forms.clear();
+			}
+			std::vector<GUID> entity_ids;
+			std::vector<T> events;
+			std::vector<unsigned char> forms;
+		};
+
+		void QueueEvent(const GUID entity_id, const T& data, const unsigned char form) {
+			std::lock_guard<std::mutex> lock(this->queue_mutex);
+			this->queued.Push(entity_id, data, form);
+		}
+
+		template <typename Data>
+		void NotifyNow(const GUID entity_id, const Data& data) {
+			ForEachSubscriber(entity_id, [entity_id, &data] (const Subscription& sub) {
+				if (sub.batched) {
+					sub.subscriber->NotifyBatch(&entity_id, AsPointer(data), 1);
+				}
+				else {
+					sub.subscriber->Notify(entity_id, data);
+				}
+			});
+		}
+
+		template <typename Data>
+		void NotifyNow(const Data& data) {
+			ForEachSubscriber(0, [&data] (const Subscription& sub) {
+				if (sub.batched) {
+					const GUID entity_id = 0;
+					sub.subscriber->NotifyBatch(&entity_id, AsPointer(data), 1);
+				}
+				else {
+					sub.subscriber->Notify(data);
+				}
+			}, false);
+		}
+
+		static const T* AsPointer(const T* data) {
+			return data;
+		}
+
+		static const T* AsPointer(const T& data) {
+			return &data;
+		}
+
+		// Visits the subscribers of entity_id and then, unless entity_id is 0 or with_any is false, the subscribers to
+		// every entity.
+		template <typename Visit>
+		void ForEachSubscriber(const GUID entity_id, Visit visit, const bool with_any = true) {
+			this->readers.fetch_add(1);
+			const SubscriptionTable* subscriptions = this->table.load();
+			VisitRange(*subscriptions, entity_id, visit);
+			if (with_any && entity_id != 0) {
+				VisitRange(*subscriptions, 0, visit);
+			}
+			this->readers.fetch_sub(1);
+		}
+
+		template <typename Visit>
+		static void VisitRange(const SubscriptionTable& subscriptions, const GUID entity_id, Visit visit) {
+			auto sub = std::lower_bound(subscriptions.begin(), subscriptions.end(), Subscription(entity_id, nullptr));
+			for (; sub != subscriptions.end() && sub->entity_id == entity_id; ++sub) {
+				visit(*sub);
+			}
+		}
+
+		// Publishes a copy of the table changed by edit, which returns false if it made no change.
+		template <typename Edit>
+		void UpdateTable(Edit edit) {
+			std::lock_guard<std::mutex> lock(this->table_mutex);
+			SubscriptionTable* subscriptions = new SubscriptionTable(*this->table.load());
+			if (!edit(*subscriptions)) {
+				delete subscriptions;
+				return;
+			}
+			this->retired.push_back(this->table.exchange(subscriptions));
+			// A notification that starts after the exchange can only see the new table.
+			if (this->readers.load() == 0) {
+				for (const SubscriptionTable* retired_table : this->retired) {
+					delete retired_table;
+				}
+				this->retired.clear();
+			}
+		}
+
+		std::atomic<const SubscriptionTable*> table;
+		std::atomic<size_t> readers; // Notifications currently reading a table.
+		std::mutex table_mutex; // Serializes table updates.
+		std::vector<const SubscriptionTable*> retired; // Replaced tables that a notification may still be reading.
+
+		std::atomic<bool> deferred;
+		std::mutex queue_mutex; // Guards queued.
+		EventBuffer queued; // Events waiting for the next DeliverEvents().
+		EventBuffer delivering; // Events being delivered, swapped with queued.
+		EventBuffer grouped; // Scratch for grouping batched events by entity.
+		std::vector<size_t> order; // Scratch for grouping batched events by entity.
 	};
 
 	template<typename T>
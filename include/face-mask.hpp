@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "voxelchunk.hpp"
+
+namespace vv {
+	// Face directions in the order VoxelVolume emits them.
+	enum FACE_DIRECTION { FACE_FRONT, FACE_TOP, FACE_BACK, FACE_BOTTOM, FACE_LEFT, FACE_RIGHT, FACE_COUNT };
+
+	enum FACE_MASK_KERNEL {
+		FACE_MASK_AUTO, // The fastest kernel the CPU supports.
+		FACE_MASK_PER_VOXEL, // One voxel per operation, the reference the other kernels are compared against.
+		FACE_MASK_SCALAR, // 64 voxels per operation using plain 64-bit integers.
+		FACE_MASK_AVX2, // 256 voxels per operation, x86 CPUs with AVX2 only.
+	};
+
+	/**
+	* \brief Finds the exposed faces of every voxel in a chunk.
+	*
+	* A face is exposed when its voxel is solid and the voxel it faces is not,
+	* so each direction is computed as solid & ~shift(solid) one occupancy word
+	* at a time. The shift pulls in the border of the neighboring chunk.
+	* \param[in] const std::uint64_t* occupancy The chunk's occupancy words.
+	* \param[in] const std::uint64_t* const neighbors[FACE_COUNT] Occupancy of the chunk in each FACE_DIRECTION, nullptr if it is empty.
+	* \param[out] std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT] Exposed face bits per direction, laid out like the occupancy.
+	* \return void
+	*/
+	void ExtractExposedFaces(const std::uint64_t* occupancy, const std::uint64_t* const neighbors[FACE_COUNT],
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]);
+
+	/**
+	* \brief Selects the kernel used by ExtractExposedFaces().
+	*
+	* Requesting a kernel the CPU doesn't support falls back to FACE_MASK_SCALAR.
+	* \param[in] const FACE_MASK_KERNEL kernel The kernel to use.
+	* \return FACE_MASK_KERNEL The kernel actually selected.
+	*/
+	FACE_MASK_KERNEL SetFaceMaskKernel(const FACE_MASK_KERNEL kernel);
+
+	FACE_MASK_KERNEL GetFaceMaskKernel();
+
+	inline int CountTrailingZeros(const std::uint64_t word) {
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctzll(word);
+#endif
+	}
+
+	inline int PopCount(const std::uint64_t word) {
+#if defined(_MSC_VER)
+		return static_cast<int>(__popcnt64(word));
+#else
+		return __builtin_popcountll(word);
+#endif
+	}
+}
@@ -11,7 +11,7 @@
 namespace vv {
 	class Shader;
 
-	typedef Multiton<std::string, std::shared_ptr<Material>> MaterialMap;
+	typedef DenseMultiton<std::string, std::shared_ptr<Material>> MaterialMap;
 
 	class Material {
 	public:
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#if defined(__BMI2__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define VV_MORTON_BMI2
+#include <immintrin.h>
+#endif
+
+namespace vv {
+	/* A Morton (Z-order) key for a signed 16-bit (row, column, slice) coordinate.
+	*
+	* The bits of the three coordinates are interleaved (column in bit 0, row
+	* in bit 1 and slice in bit 2 of each triple) into the low 48 bits, so
+	* sorting by key visits coordinates that are close in space together.
+	* Each coordinate is biased by flipping its sign bit before interleaving,
+	* which keeps negative coordinates ordered below positive ones and makes
+	* decoding a plain de-interleave.
+	*/
+	struct MortonKey {
+		static const std::uint64_t COLUMN_MASK = 0x249249249249ULL;
+		static const std::uint64_t ROW_MASK = COLUMN_MASK << 1;
+		static const std::uint64_t SLICE_MASK = COLUMN_MASK << 2;
+
+		MortonKey() : value(0) { }
+		explicit MortonKey(const std::uint64_t value) : value(value) { }
+
+		static MortonKey Encode(const short row, const short column, const short slice) {
+			return MortonKey(Spread(Bias(row), ROW_MASK) | Spread(Bias(column), COLUMN_MASK) | Spread(Bias(slice), SLICE_MASK));
+		}
+
+		short Row() const {
+			return Unbias(Compact(this->value, ROW_MASK));
+		}
+
+		short Column() const {
+			return Unbias(Compact(this->value, COLUMN_MASK));
+		}
+
+		short Slice() const {
+			return Unbias(Compact(this->value, SLICE_MASK));
+		}
+
+		/**
+		* \brief Returns the key of the coordinate offset by (d_row, d_column, d_slice) without decoding.
+		*
+		* Each axis is added in place by filling the other axes' bits with ones so the carry ripples across
+		* them. Coordinates wrap at the 16-bit boundary like short arithmetic.
+		* \param[in] const int d_row The row offset.
+		* \param[in] const int d_column The column offset.
+		* \param[in] const int d_slice The slice offset.
+		* \return MortonKey The offset key.
+		*/
+		MortonKey Offset(const int d_row, const int d_column, const int d_slice) const {
+			return MortonKey(Add(this->value, Spread(static_cast<std::uint16_t>(d_row), ROW_MASK), ROW_MASK) |
+				Add(this->value, Spread(static_cast<std::uint16_t>(d_column), COLUMN_MASK), COLUMN_MASK) |
+				Add(this->value, Spread(static_cast<std::uint16_t>(d_slice), SLICE_MASK), SLICE_MASK));
+		}
+
+		bool operator==(const MortonKey& other) const {
+			return this->value == other.value;
+		}
+
+		bool operator!=(const MortonKey& other) const {
+			return this->value != other.value;
+		}
+
+		bool operator<(const MortonKey& other) const {
+			return this->value < other.value;
+		}
+
+		struct Hash {
+			size_t operator()(const MortonKey& key) const {
+				return std::hash<std::uint64_t>()(key.value);
+			}
+		};
+
+		std::uint64_t value;
+	private:
+		static std::uint64_t Bias(const short coord) {
+			return static_cast<std::uint16_t>(coord) ^ 0x8000u;
+		}
+
+		static short Unbias(const std::uint64_t coord) {
+			return static_cast<short>(static_cast<std::uint16_t>(coord ^ 0x8000u));
+		}
+
+		static std::uint64_t Add(const std::uint64_t key, const std::uint64_t delta, const std::uint64_t mask) {
+			return ((key | ~mask) + delta) & mask;
+		}
+
+		// Deposits the low 16 bits of coord into the bits of mask.
+		static std::uint64_t Spread(const std::uint64_t coord, const std::uint64_t mask) {
+#ifdef VV_MORTON_BMI2
+			return _pdep_u64(coord, mask);
+#else
+			std::uint64_t x = coord & 0xFFFF;
+			x = (x | (x << 16)) & 0x0000FF0000FFULL;
+			x = (x | (x << 8)) & 0x00F00F00F00FULL;
+			x = (x | (x << 4)) & 0x0C30C30C30C3ULL;
+			x = (x | (x << 2)) & COLUMN_MASK;
+			return mask == COLUMN_MASK ? x : (mask == ROW_MASK ? x << 1 : x << 2);
+#endif
+		}
+
+		// Extracts the bits of mask from key into the low 16 bits.
+		static std::uint64_t Compact(const std::uint64_t key, const std::uint64_t mask) {
+#ifdef VV_MORTON_BMI2
+			return _pext_u64(key, mask);
+#else
+			std::uint64_t x = (mask == COLUMN_MASK ? key : (mask == ROW_MASK ? key >> 1 : key >> 2)) & COLUMN_MASK;
+			x = (x | (x >> 2)) & 0x0C30C30C30C3ULL;
+			x = (x | (x >> 4)) & 0x00F00F00F00FULL;
+			x = (x | (x >> 8)) & 0x0000FF0000FFULL;
+			x = (x | (x >> 16)) & 0xFFFF;
+			return x;
+#endif
+		}
+	};
+}
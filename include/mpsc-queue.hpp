@@ -0,0 +1,273 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace vv {
+	/* An unbounded lock-free multi-producer single-consumer queue of objects derived from Base, stored by value.
+	*
+	* Objects of any derived type are placement constructed back to back in
+	* a linked list of fixed size byte segments, each behind a small record
+	* header. A producer claims a record with a single fetch_add on the tail
+	* segment, constructs the object and publishes it by storing the record
+	* size, so producers never wait on each other or on the consumer except
+	* to link a new segment when one fills up. The consumer walks the records
+	* in claim order, stopping at the first one that isn't published yet, and
+	* destroys each object in place after visiting it.
+	*
+	* Emplace() may be called from any thread. Drain() must only be called
+	* from one thread at a time. Stored types must be at most 16 byte aligned
+	* and Base must be their first (or only) base class.
+	*
+	* Consumed segments can still be referenced by a producer that loaded the
+	* tail just before it moved on, so they are only reused once the consumer
+	* sees no producer inside Emplace(). The consumer links reused segments
+	* ahead of the tail, so once the queue has grown to its peak per drain
+	* volume no more memory is allocated.
+	*/
+	template <typename Base>
+	class MPSCQueue {
+	public:
+		static const size_t SEGMENT_BYTES = 16384;
+
+		MPSCQueue() : head_offset(0), producers(0), segment_allocations(1) {
+			this->head = new Segment();
+			this->tail.store(this->head);
+		}
+
+		~MPSCQueue() {
+			// Objects that were never drained still need their destructors run.
+			Drain([] (Base*) { });
+			for (Segment* segment : this->retired) {
+				delete segment;
+			}
+			while (this->head) {
+				Segment* next = this->head->next.load();
+				delete this->head;
+				this->head = next;
+			}
+		}
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		// Constructs a U from args at the end of the queue. Safe to call from any thread.
+		template <typename U, typename... Args>
+		void Emplace(Args&&... args) {
+			static_assert(alignof(U) <= ALIGNMENT, "MPSCQueue records are only 16 byte aligned");
+			static_assert(RecordSize<U>() <= SEGMENT_BYTES, "Type is too big for an MPSCQueue segment");
+			const size_t size = RecordSize<U>();
+
+			this->producers.fetch_add(1);
+			Segment* segment = this->tail.load();
+			for (;;) {
+				size_t offset = segment->claimed.fetch_add(size, std::memory_order_relaxed);
+				if (offset + size <= SEGMENT_BYTES) {
+					Header* header = reinterpret_cast<Header*>(segment->bytes + offset);
+					header->destroy = &Destroy<U>;
+					new (segment->bytes + offset + HEADER_SIZE) U(std::forward<Args>(args)...);
+					header->size.store(static_cast<std::uint32_t>(size), std::memory_order_release);
+					break;
+				}
+				// The record that crosses the end of the segment marks where the consumer has to move on.
+				if (offset < SEGMENT_BYTES) {
+					reinterpret_cast<Header*>(segment->bytes + offset)->size.store(END, std::memory_order_release);
+				}
+
+				// The segment is full, link a new one (or use the one another producer linked) and move the tail to it.
+				Segment* next = segment->next.load(std::memory_order_acquire);
+				if (!next) {
+					Segment* fresh = new Segment();
+					if (segment->next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel)) {
+						next = fresh;
+						this->segment_allocations.fetch_add(1, std::memory_order_relaxed);
+					}
+					else {
+						delete fresh;
+					}
+				}
+				this->tail.compare_exchange_strong(segment, next);
+				segment = this->tail.load();
+			}
+			this->producers.fetch_sub(1, std::memory_order_release);
+		}
+
+		/**
+		* \brief Visits up to max_count published objects in queue order, destroying each one after its visit.
+		*
+		* Only call from the consuming thread. Objects queued by visit itself are visited in the same drain.
+		* \param[in] Visit visit Called with a Base* to each object.
+		* \param[in] const size_t max_count The most objects to visit.
+		* \return size_t The number of objects visited.
+		*/
+		template <typename Visit>
+		size_t Drain(Visit visit, const size_t max_count = static_cast<size_t>(-1)) {
+			size_t count = 0;
+			for (;;) {
+				Header* header = nullptr;
+				std::uint32_t size = END;
+				if (this->head_offset < SEGMENT_BYTES) {
+					header = reinterpret_cast<Header*>(this->head->bytes + this->head_offset);
+					size = header->size.load(std::memory_order_acquire);
+					if (!size) {
+						break;
+					}
+				}
+				if (size == END) {
+					Segment* next = this->head->next.load(std::memory_order_acquire);
+					if (!next) {
+						break;
+					}
+					// Make sure the tail has moved past the head before retiring it so no new producer can reach it.
+					Segment* expected = this->head;
+					this->tail.compare_exchange_strong(expected, next);
+					this->retired.push_back(this->head);
+					this->head = next;
+					this->head_offset = 0;
+					continue;
+				}
+				if (!header->destroy) {
+					this->head_offset += size; // Already released.
+					continue;
+				}
+				if (count == max_count) {
+					break;
+				}
+
+				Base* object = reinterpret_cast<Base*>(this->head->bytes + this->head_offset + HEADER_SIZE);
+				visit(object);
+				header->destroy(object);
+				this->head_offset += size;
+				++count;
+			}
+			if (!this->retired.empty() && this->producers.load() == 0) {
+				RecycleRetired();
+			}
+			return count;
+		}
+
+		/**
+		* \brief Visits up to max_count published objects in queue order without consuming them.
+		*
+		* Only call from the consuming thread. A following Drain() with the returned count visits the same objects.
+		* \param[in] Visit visit Called with a Base* to each object.
+		* \param[in] const size_t max_count The most objects to visit.
+		* \return size_t The number of objects visited.
+		*/
+		template <typename Visit>
+		size_t Peek(Visit visit, const size_t max_count = static_cast<size_t>(-1)) {
+			Segment* segment = this->head;
+			size_t offset = this->head_offset;
+			size_t count = 0;
+			while (count < max_count) {
+				std::uint32_t size = END;
+				if (offset < SEGMENT_BYTES) {
+					size = reinterpret_cast<Header*>(segment->bytes + offset)->size.load(std::memory_order_acquire);
+					if (!size) {
+						break;
+					}
+				}
+				if (size == END) {
+					segment = segment->next.load(std::memory_order_acquire);
+					if (!segment) {
+						break;
+					}
+					offset = 0;
+					continue;
+				}
+				if (reinterpret_cast<Header*>(segment->bytes + offset)->destroy) {
+					visit(reinterpret_cast<Base*>(segment->bytes + offset + HEADER_SIZE));
+					++count;
+				}
+				offset += size;
+			}
+			return count;
+		}
+
+		/**
+		* \brief Destroys an object found by Peek() ahead of the objects queued before it.
+		*
+		* The object's space is reclaimed once a later Drain() reaches it, Drain() and Peek() skip it until then.
+		* Only call from the consuming thread, or from several threads for different objects while no Drain() or
+		* Peek() is running.
+		* \param[in] Base* object An object visited by Peek() that hasn't been drained or released yet.
+		* \return void
+		*/
+		void Release(Base* object) {
+			Header* header = reinterpret_cast<Header*>(reinterpret_cast<unsigned char*>(object) - HEADER_SIZE);
+			header->destroy(object);
+			header->destroy = nullptr;
+		}
+
+		// Returns the number of segments allocated so far. Stops growing once the queue reaches its steady state size.
+		size_t GetSegmentAllocations() const {
+			return this->segment_allocations.load(std::memory_order_relaxed);
+		}
+	private:
+		static const size_t ALIGNMENT = 16;
+		static const std::uint32_t END = 0xFFFFFFFFu; // Record size marking the end of a segment's records.
+
+		struct Header {
+			std::atomic<std::uint32_t> size; // 0 until the object is published.
+			void (*destroy)(Base*); // nullptr once the object has been released.
+		};
+		static const size_t HEADER_SIZE = (sizeof(Header) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+		template <typename U>
+		static constexpr size_t RecordSize() {
+			return HEADER_SIZE + ((sizeof(U) + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+		}
+
+		template <typename U>
+		static void Destroy(Base* object) {
+			static_cast<U*>(object)->~U();
+		}
+
+		struct Segment {
+			Segment() : claimed(0), next(nullptr), bytes() { }
+			std::atomic<size_t> claimed; // Bytes handed out, keeps counting past SEGMENT_BYTES once full.
+			std::atomic<Segment*> next;
+			alignas(16) unsigned char bytes[SEGMENT_BYTES]; // Zeroed, so every header reads as unpublished.
+		};
+
+		// Links the retired segments after the last segment for producers to fill again.
+		// Only segments at or after the head are reachable, so the consumer can walk them safely.
+		void RecycleRetired() {
+			Segment* last = this->tail.load();
+			for (Segment* next = last->next.load(std::memory_order_acquire); next; next = next->next.load(std::memory_order_acquire)) {
+				last = next;
+			}
+			for (Segment* segment : this->retired) {
+				// Records may land at different offsets next time, so every byte has to read as unpublished again.
+				memset(segment->bytes, 0, SEGMENT_BYTES);
+				segment->claimed.store(0, std::memory_order_relaxed);
+				segment->next.store(nullptr, std::memory_order_relaxed);
+				// A producer may have linked a segment after last in the meantime, follow it and try again.
+				Segment* expected = nullptr;
+				while (!last->next.compare_exchange_weak(expected, segment, std::memory_order_release)) {
+					if (expected) {
+						last = expected;
+						expected = nullptr;
+					}
+				}
+				last = segment;
+			}
+			this->retired.clear();
+		}
+
+		// Consumer side.
+		Segment* head;
+		size_t head_offset;
+		std::vector<Segment*> retired; // Consumed segments waiting for producers to leave them before reuse.
+
+		// Producer side, on its own cache line so claiming records doesn't contend with the consumer.
+		alignas(64) std::atomic<Segment*> tail;
+		std::atomic<size_t> producers; // Producers currently inside Emplace().
+		std::atomic<size_t> segment_allocations;
+	};
+}
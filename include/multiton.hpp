@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace vv {
 	typedef long long GUID;
@@ -95,4 +100,188 @@ namespace vv {
 
 	template <typename ID, typename T>
 	T Multiton<ID, T>::default_value;
+
+	// Refers to an instance of a DenseMultiton. Once the instance is removed the handle no longer resolves, even if
+	// its slot is reused.
+	struct MultitonHandle {
+		MultitonHandle() : slot(0), generation(0) { }
+		MultitonHandle(const std::uint32_t slot, const std::uint32_t generation) : slot(slot), generation(generation) { }
+		std::uint32_t slot;
+		std::uint32_t generation; // 0 never matches an instance, so a default handle is always invalid.
+	};
+
+	/* A Multiton that keeps its instances contiguous.
+	*
+	* Instances are stored back to back in one vector, with no gaps, so
+	* iterating is a linear walk. Removing an instance moves the last one into
+	* its place. Each ID maps to a slot, and the slot holds the instance's
+	* current position and a generation that is bumped when the instance is
+	* removed. A handle (slot and generation) resolves with two array lookups
+	* and no hashing, so hot paths can hold handles instead of IDs.
+	*
+	* Has the same Get/Set/Remove/Begin/End interface as Multiton, but the
+	* iteration order is not sorted by ID and changes as instances are
+	* removed.
+	*/
+	template <typename ID, typename T>
+	class DenseMultiton {
+	public:
+		// Get the default instance.
+		static T Default() {
+			return default_value;
+		}
+
+		// Set the default instance.
+		static void Default(const T value) {
+			default_value = value;
+		}
+
+		// Iterates over (ID, instance) pairs.
+		static typename std::vector<std::pair<ID, T>>::const_iterator Begin() {
+			return instances.begin();
+		}
+
+		static typename std::vector<std::pair<ID, T>>::const_iterator End() {
+			return instances.end();
+		}
+
+		static size_t Count() {
+			return instances.size();
+		}
+
+		/**
+		* \brief Get the instance for the given ID.
+		*
+		* This doesn't create an instance if the ID doesn't exist. Instead it just returns the default.
+		* \param[in] const ID The ID of the instance to get.
+		* \return T The ID's instance or the default one.
+		*/
+		static T Get(const ID id) {
+			const T* instance = Find(id);
+			return instance ? *instance : default_value;
+		}
+
+		// Get the instance handle refers to, or the default if it was removed.
+		static T Get(const MultitonHandle handle) {
+			const T* instance = Find(handle);
+			return instance ? *instance : default_value;
+		}
+
+		// Returns the ID's instance without copying it, or nullptr if the ID doesn't exist. The pointer is only valid
+		// until the next Set() or Remove().
+		static const T* Find(const ID id) {
+			auto handle = handles.find(id);
+			if (handle == handles.end()) {
+				return nullptr;
+			}
+			return &instances[slots[handle->second.slot].index].second;
+		}
+
+		// Returns the instance handle refers to, or nullptr if it was removed. See Find(const ID).
+		static const T* Find(const MultitonHandle handle) {
+			if (handle.slot >= slots.size() || slots[handle.slot].generation != handle.generation) {
+				return nullptr;
+			}
+			return &instances[slots[handle.slot].index].second;
+		}
+
+		// Returns the handle of the ID's instance, or an invalid handle if the ID doesn't exist.
+		static MultitonHandle GetHandle(const ID id) {
+			auto handle = handles.find(id);
+			return handle == handles.end() ? MultitonHandle() : handle->second;
+		}
+
+		/**
+		* \brief Set (or add/create) an instance for the given ID.
+		*
+		* \param[in] const ID id The ID of the instance to set.
+		* \param[in] T instance The ID's instance.
+		* \return MultitonHandle The handle of the ID's instance, unchanged if the ID already existed.
+		*/
+		static MultitonHandle Set(const ID id, const T instance) {
+			auto handle = handles.find(id);
+			if (handle != handles.end()) {
+				instances[slots[handle->second.slot].index].second = instance;
+				return handle->second;
+			}
+
+			std::uint32_t slot;
+			if (!free_slots.empty()) {
+				slot = free_slots.back();
+				free_slots.pop_back();
+			}
+			else {
+				slot = static_cast<std::uint32_t>(slots.size());
+				slots.push_back(Slot());
+			}
+			slots[slot].index = static_cast<std::uint32_t>(instances.size());
+			instances.push_back(std::make_pair(id, instance));
+			instance_slots.push_back(slot);
+
+			MultitonHandle added(slot, slots[slot].generation);
+			handles[id] = added;
+			return added;
+		}
+
+		/**
+		* \brief Remove the instance for the given ID.
+		*
+		* \param[in] const ID id The ID of the instance to remove.
+		* \return void
+		*/
+		static void Remove(const ID id) {
+			auto handle = handles.find(id);
+			if (handle == handles.end()) {
+				return;
+			}
+			const std::uint32_t slot = handle->second.slot;
+			const std::uint32_t index = slots[slot].index;
+			const std::uint32_t last = static_cast<std::uint32_t>(instances.size() - 1);
+			if (index != last) {
+				instances[index] = std::move(instances[last]);
+				instance_slots[index] = instance_slots[last];
+				slots[instance_slots[index]].index = index;
+			}
+			instances.pop_back();
+			instance_slots.pop_back();
+
+			// Outstanding handles to the slot stop resolving.
+			if (++slots[slot].generation == 0) {
+				slots[slot].generation = 1;
+			}
+			free_slots.push_back(slot);
+			handles.erase(handle);
+		}
+	protected:
+		struct Slot {
+			Slot() : index(0), generation(1) { }
+			std::uint32_t index; // Position of the slot's instance in instances.
+			std::uint32_t generation;
+		};
+
+		static T default_value; // Default instance.
+		static std::vector<std::pair<ID, T>> instances; // Every instance, back to back.
+		static std::vector<std::uint32_t> instance_slots; // Slot of each instance.
+		static std::vector<Slot> slots;
+		static std::vector<std::uint32_t> free_slots;
+		static std::unordered_map<ID, MultitonHandle> handles; // Mapping of ID to its instance's handle.
+	};
+
+	template <typename ID, typename T>
+	T DenseMultiton<ID, T>::default_value;
+
+	template <typename ID, typename T>
+	std::vector<std::pair<ID, T>> DenseMultiton<ID, T>::instances;
+
+	template <typename ID, typename T>
+	std::vector<std::uint32_t> DenseMultiton<ID, T>::instance_slots;
+
+	template <typename ID, typename T>
+	std::vector<typename DenseMultiton<ID, T>::Slot> DenseMultiton<ID, T>::slots;
+
+	template <typename ID, typename T>
+	std::vector<std::uint32_t> DenseMultiton<ID, T>::free_slots;
+
+	template <typename ID, typename T>
+	std::unordered_map<ID, MultitonHandle> DenseMultiton<ID, T>::handles;
 }
@@ -83,6 +83,7 @@ namespace vv {
 		/**
 		* \brief Processes events in the OS message event loop.
 		*
+		* Input events buffered by deferred dispatchers are delivered once all the pending OS events are processed.
 		*/
 		void OSMessageLoop();
 
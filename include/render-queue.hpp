@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vv {
+	/* A per frame list of draws, sorted by 64 bit key so that draws sharing state end up next to each other.
+	*
+	* The key holds, from the most significant bits down, the shader, material
+	* and vertex buffer IDs and then a quantized view depth. Sorting on it
+	* groups draws by the state that is most costly to change, and draws front
+	* to back within a group. IDs past a field's width alias other IDs, which
+	* only makes the grouping worse, so the submission loop should compare the
+	* real IDs before skipping a state change.
+	*
+	* Sorting is an LSD radix sort, one 8 bit digit per pass. Passes where
+	* every key has the same digit are skipped, so unused high bits cost
+	* nothing.
+	*/
+	class RenderQueue {
+	public:
+		static const unsigned int SHADER_BITS = 12;
+		static const unsigned int MATERIAL_BITS = 12;
+		static const unsigned int BUFFER_BITS = 16;
+		static const unsigned int DEPTH_BITS = 24;
+
+		struct Entry {
+			std::uint64_t key;
+			std::uint32_t item; // Index of the draw in the caller's list.
+		};
+
+		/**
+		* \brief Packs state IDs and a quantized depth into a sort key.
+		*
+		* \param[in] const std::uint32_t shader The shader ID, only the low SHADER_BITS are used.
+		* \param[in] const std::uint32_t material The material ID, only the low MATERIAL_BITS are used.
+		* \param[in] const std::uint32_t buffer The vertex buffer ID, only the low BUFFER_BITS are used.
+		* \param[in] const std::uint32_t depth A depth from QuantizeDepth().
+		* \return std::uint64_t The sort key.
+		*/
+		static std::uint64_t MakeSortKey(const std::uint32_t shader, const std::uint32_t material,
+			const std::uint32_t buffer, const std::uint32_t depth);
+
+		// Maps a view space distance in [near_plane, far_plane] to DEPTH_BITS, closer is smaller. Values outside are
+		// clamped.
+		static std::uint32_t QuantizeDepth(const float distance, const float near_plane, const float far_plane);
+
+		void Clear() {
+			this->entries.clear();
+		}
+
+		void Push(const std::uint64_t key, const std::uint32_t item) {
+			Entry entry = {key, item};
+			this->entries.push_back(entry);
+		}
+
+		// Sorts the entries by key, entries with equal keys keep the order they were pushed in.
+		void Sort();
+
+		size_t GetCount() const {
+			return this->entries.size();
+		}
+
+		const Entry& operator[](const size_t index) const {
+			return this->entries[index];
+		}
+	private:
+		std::vector<Entry> entries;
+		std::vector<Entry> scratch; // The other buffer of each radix pass, kept to reuse its storage.
+	};
+}
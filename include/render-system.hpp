@@ -1,10 +1,10 @@
 #pragma once
 
 #include <memory>
-#include <list>
 #include <map>
 #include <atomic>
 #include <queue>
+#include <unordered_set>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/quaternion.hpp>
 
@@ -16,10 +16,13 @@
 
 #include "multiton.hpp"
 #include "command-queue.hpp"
+#include "transform-store.hpp"
+#include "render-queue.hpp"
 
 namespace vv {
 	struct VertexBuffer;
 	class Material;
+	class Shader;
 
 	enum RS_COMMAND {
 		VIEW_ADD,
@@ -44,7 +47,25 @@ namespace vv {
 		glm::mat4 transform;
 	};
 
-	typedef Multiton<GUID, std::shared_ptr<ModelMatrix>> ModelMatrixMap;
+	// Counts from the last frame's model matrix update.
+	struct ModelMatrixStats {
+		ModelMatrixStats() : transforms_changed(0), matrices_rebuilt(0), world_matrices_rebuilt(0) { }
+		size_t transforms_changed; // Dirty transforms taken from Transform::TakeDirtyList().
+		size_t matrices_rebuilt; // Includes unchanged matrices that share a TransformStore block with a changed one.
+		size_t world_matrices_rebuilt; // Entities in a hierarchy whose own or an ancestor's transform changed.
+	};
+
+	// Counts from the last frame's draw submission.
+	struct RenderQueueStats {
+		RenderQueueStats() : draws_queued(0), draw_calls(0), shader_changes(0), material_changes(0), vao_changes(0),
+			build_time_us(0.0) { }
+		size_t draws_queued; // (material, buffer, entity) triples that were alive this frame.
+		size_t draw_calls; // An instanced draw counts once.
+		size_t shader_changes;
+		size_t material_changes;
+		size_t vao_changes;
+		double build_time_us; // Locking, keying and sorting the draws.
+	};
 
 	class RenderSystem : public CommandQueue < RS_COMMAND > {
 	public:
@@ -54,23 +75,108 @@ namespace vv {
 
 		void Update(const double delta);
 
+		/**
+		* \brief Draws entity_id with the vertex buffer and material every frame.
+		*
+		* Any number of triples can share a material, a buffer or an entity. A triple whose material, shader or
+		* buffer has expired is dropped by the next frame, along with the expired material, shader or buffer. The
+		* material's shader is looked up every frame.
+		* \param[in] const std::weak_ptr<Material> mat The material to draw with.
+		* \param[in] const std::weak_ptr<VertexBuffer> buffer The mesh to draw.
+		* \param[in] const GUID entity_id The entity whose model matrix places the mesh.
+		* \return void
+		*/
 		void AddVertexBuffer(const std::weak_ptr<Material> mat, const std::weak_ptr<VertexBuffer> buffer, const GUID entity_id);
 
+		/**
+		* \brief Copies out an entity's model matrix as of the last frame.
+		*
+		* Model matrices live in the render system's TransformStore and include the entity's parents.
+		* \param[in] const GUID entity_id The entity.
+		* \param[out] ModelMatrix& matrix Set to the entity's model matrix, left as is if it has none.
+		* \return bool False if the entity has no model matrix.
+		*/
+		bool GetModelMatrix(const GUID entity_id, ModelMatrix& matrix) const;
+
+		const ModelMatrixStats& GetModelMatrixStats() const {
+			return this->model_matrix_stats;
+		}
+
+		const RenderQueueStats& GetRenderQueueStats() const {
+			return this->render_queue_stats;
+		}
+
 	protected:
 		void ProcessCommandQueue();
 
-		void UpdateModelMatrix(const GUID entity_id);
+		// Takes the transforms changed since the last frame and rebuilds their model matrices and any views on them.
+		void UpdateModelMatrices();
+
+		// Copies the entity's transform into the store. Returns false if the entity has no transform in the TransformMap.
+		bool UpdateModelMatrix(const GUID entity_id);
 
 		void RemoveModelMatrix(const GUID entity_id);
 
 		void UpdateViewMatrix(const GUID eneity_id);
 
+		// Locks this frame's materials, shaders and buffers, drops the expired ones, then queues and sorts a key for every
+		// drawable triple.
+		void BuildRenderQueue(const glm::mat4& camera_matrix);
+
+		// Draws the sorted queue, binding each piece of state only when it changes.
+		void SubmitRenderQueue(const glm::mat4& camera_matrix);
+
+		// Returns the index in shaders of shader, adding a binding (and looking up its locations) if it is new.
+		std::uint32_t FindShader(const std::shared_ptr<Shader>& shader);
+
 		//void CreateVertexBuffer(GUID entity_id, const std::vector<Vertex>& verts, const std::vector<GLuint>& indicies);
 	private:
 		glm::mat4 projection;
 		std::map<GUID, glm::mat4> views;
+		std::unordered_set<GUID> stale_views; // Views to recompute once this frame's model matrices are rebuilt.
+		TransformStore transforms;
+		std::vector<GUID> dirty_transforms;
+		// Entities whose transform wasn't in the TransformMap when they were added or became dirty, retried each frame
+		// until it is or the model matrix is removed. Their dirty flag stays set, so they would never be listed again.
+		// Dirty entities without a model matrix or a MODEL_MATRIX_ADD are dropped rather than retried forever.
+		std::unordered_set<GUID> unresolved_transforms;
+		ModelMatrixStats model_matrix_stats;
 		GUID current_view;
 		unsigned int window_width, window_height;
-		std::map<std::weak_ptr<Material>, std::pair<std::weak_ptr<VertexBuffer>, std::list<GUID>>, std::owner_less<std::weak_ptr<Material>>> buffers;
+
+		static const std::uint32_t NO_SHADER = 0xFFFFFFFF;
+		static const std::uint32_t DROPPED = 0xFFFFFFFF;
+
+		// Uniform and attribute locations are looked up once, the first frame a material uses the shader.
+		struct ShaderBinding {
+			std::weak_ptr<Shader> shader;
+			GLint view, projection, model, palette;
+			GLint instance_attribute; // in_Model, -1 if the shader takes the model matrix as a uniform.
+		};
+		struct RenderItem {
+			std::uint32_t material; // Index in materials.
+			std::uint32_t buffer; // Index in buffers.
+			GUID entity_id;
+		};
+		// Expired entries are removed each frame, so the indices stay below the live count and fit the sort key fields.
+		std::vector<ShaderBinding> shaders;
+		std::vector<std::weak_ptr<Material>> materials;
+		std::vector<std::weak_ptr<VertexBuffer>> buffers;
+		std::vector<RenderItem> render_items;
+		// Index of each entry in the vectors above, keyed by owner so an expired entry can still be found and erased.
+		std::map<std::weak_ptr<Shader>, std::uint32_t, std::owner_less<std::weak_ptr<Shader>>> shader_indices;
+		std::map<std::weak_ptr<Material>, std::uint32_t, std::owner_less<std::weak_ptr<Material>>> material_indices;
+		std::map<std::weak_ptr<VertexBuffer>, std::uint32_t, std::owner_less<std::weak_ptr<VertexBuffer>>> buffer_indices;
+
+		// Per frame scratch, kept to reuse their storage. The locked pointers are released at the end of each frame.
+		std::vector<std::shared_ptr<Shader>> frame_shaders;
+		std::vector<std::shared_ptr<Material>> frame_materials;
+		std::vector<std::uint32_t> frame_material_shaders; // Index in shaders of each material's shader, or NO_SHADER.
+		std::vector<std::shared_ptr<VertexBuffer>> frame_buffers;
+		// New index of each shader, material and buffer after the expired ones are dropped, or DROPPED.
+		std::vector<std::uint32_t> shader_remap, material_remap, buffer_remap;
+		RenderQueue render_queue;
+		std::vector<glm::mat4> instance_matrices; // Scratch for an instanced draw.
+		RenderQueueStats render_queue_stats;
 	};
 }
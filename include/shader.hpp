@@ -15,7 +15,7 @@
 namespace vv {
 	class Shader;
 
-	typedef Multiton<std::string, std::shared_ptr<Shader>> ShaderMap;
+	typedef DenseMultiton<std::string, std::shared_ptr<Shader>> ShaderMap;
 
 	class Shader {
 	public:
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "multiton.hpp"
+
+namespace vv {
+	enum MATRIX_KERNEL {
+		MATRIX_KERNEL_AUTO, // The fastest kernel the CPU supports.
+		MATRIX_KERNEL_SCALAR, // One matrix at a time.
+		MATRIX_KERNEL_SSE, // 4 matrices per operation, x86 CPUs only.
+	};
+
+	/* The translation, orientation and scale of many entities stored as a structure of arrays, and their model matrices.
+	*
+	* Each component (translation x, orientation w, ...) has its own array,
+	* so rebuilding model matrices reads every array front to back. Entities
+	* are kept in blocks of 4 lanes, and changing a transform marks its block
+	* dirty. UpdateModelMatrices() then rebuilds every dirty block in one
+	* pass, 4 matrices at a time with the SSE kernel. Rebuilding a clean lane
+	* of a dirty block just rewrites the same matrix.
+	*
+	* Model matrices are translation * rotation * scale, in glm's column
+	* major layout.
+	*
+	* Entities can have a parent, their model matrix is then the parent's
+	* world matrix * their own. Entities in a hierarchy are flattened into an
+	* array where parents come before their children, so world matrices are
+	* updated in one linear pass. A changed entity marks its descendants
+	* changed as the pass reaches them. Changing a parent link only touches
+	* the moved entity: it is relinked in place if its new parent is already
+	* before it, otherwise its subtree is moved to the end of the array and
+	* leaves dead nodes behind. The array is rebuilt breadth first once dead
+	* nodes make up half of it.
+	*/
+	class TransformStore {
+	public:
+		static const size_t BLOCK_SIZE = 4; // Lanes per block.
+
+		TransformStore();
+
+		/**
+		* \brief Sets the transform of an entity, adding the entity if it isn't in the store yet.
+		*
+		* The model matrix isn't rebuilt until the next UpdateModelMatrices().
+		* \param[in] const GUID entity_id The entity.
+		* \param[in] const glm::vec3& translation The entity's translation.
+		* \param[in] const glm::quat& orientation The entity's orientation.
+		* \param[in] const glm::vec3& scale The entity's scale.
+		* \return void
+		*/
+		void Set(const GUID entity_id, const glm::vec3& translation, const glm::quat& orientation, const glm::vec3& scale);
+
+		// Removes the entity's transform and model matrix. The last entity is moved into its place.
+		void Remove(const GUID entity_id);
+
+		bool Contains(const GUID entity_id) const {
+			return this->indices.find(entity_id) != this->indices.end();
+		}
+
+		size_t GetCount() const {
+			return this->entity_ids.size();
+		}
+
+		/**
+		* \brief Sets the parent of an entity, it then moves with the parent.
+		*
+		* The parent doesn't need to be in the store, a missing parent counts as the identity transform. Children of a
+		* removed entity keep their link and pick it back up if it's added again.
+		* \param[in] const GUID entity_id The child entity.
+		* \param[in] const GUID parent_id The parent entity, 0 for none.
+		* \return bool False if the parent is a descendant of entity_id, the link is then left unchanged.
+		*/
+		bool SetParent(const GUID entity_id, const GUID parent_id);
+
+		// Returns the entity's parent, 0 if it has none.
+		GUID GetParent(const GUID entity_id) const;
+
+		// Returns the entity's model matrix, including its parents', as of the last UpdateModelMatrices(), or nullptr if
+		// the entity isn't in the store. The pointer is only valid until the next Set(), Remove() or SetParent().
+		const glm::mat4* GetModelMatrix(const GUID entity_id) const;
+
+		// Rebuilds the model matrices of every dirty block, then the world matrices of changed entities in a hierarchy
+		// and their descendants. Returns the number of entities' matrices rebuilt, which includes the unchanged
+		// entities that share a block with a changed one.
+		size_t UpdateModelMatrices();
+
+		// Returns the number of world matrices the last UpdateModelMatrices() computed.
+		size_t GetWorldMatrixUpdateCount() const {
+			return this->world_matrix_updates;
+		}
+
+		// Selects the kernel used by UpdateModelMatrices(). Requesting one the CPU doesn't support falls back to
+		// MATRIX_KERNEL_SCALAR. Returns the kernel actually selected.
+		MATRIX_KERNEL SetKernel(const MATRIX_KERNEL kernel);
+
+		MATRIX_KERNEL GetKernel() const {
+			return this->kernel;
+		}
+	private:
+		// Component arrays, in the order they are stored in components.
+		enum COMPONENT {
+			TRANSLATION_X, TRANSLATION_Y, TRANSLATION_Z,
+			ORIENTATION_X, ORIENTATION_Y, ORIENTATION_Z, ORIENTATION_W,
+			SCALE_X, SCALE_Y, SCALE_Z,
+			COMPONENT_COUNT
+		};
+
+		// Writes the identity transform to index, used for new entities and the unused lanes of the last block.
+		void Reset(const size_t index);
+
+		void MarkDirty(const size_t index);
+
+		// Flattens the parent links breadth first into hierarchy, dropping the dead nodes.
+		void RebuildHierarchy();
+
+		// Applies a changed parent link to hierarchy, see SetParent().
+		void Relink(const GUID entity_id, const GUID parent_id);
+
+		// Appends a node for entity_id under parent (NO_INDEX for a top) and returns its index.
+		std::uint32_t AddNode(const GUID entity_id, const std::uint32_t parent);
+
+		// Adds node to the front of parent's children.
+		void LinkChild(const std::uint32_t node, const std::uint32_t parent);
+
+		// Takes node out of its parent's children, it becomes a top.
+		void UnlinkChild(const std::uint32_t node);
+
+		// Marks node dead if it has neither a parent nor children, it is then no longer part of a hierarchy.
+		void ReleaseIfAlone(const std::uint32_t node);
+
+		// Moves node and its descendants to the end of hierarchy under parent, keeping their order.
+		void MoveSubtree(const std::uint32_t node, const std::uint32_t parent);
+
+		// Computes the world matrix of every hierarchy node that, or whose ancestor, changed.
+		void UpdateWorldMatrices();
+
+		static const std::uint32_t NO_INDEX = 0xFFFFFFFF;
+
+		// An entity with a parent or children.
+		struct HierarchyNode {
+			GUID entity_id; // 0 for a dead node.
+			std::uint32_t lane; // NO_INDEX if the entity isn't in the store.
+			std::uint32_t parent; // Index in hierarchy, NO_INDEX for the top of a hierarchy.
+			// A node's children are a list through their sibling indices, so a subtree is found without a scan.
+			std::uint32_t first_child;
+			std::uint32_t next_sibling;
+			std::uint32_t previous_sibling;
+		};
+
+		MATRIX_KERNEL kernel;
+		std::unordered_map<GUID, std::uint32_t> indices; // Entity to lane index.
+		std::vector<GUID> entity_ids; // Entity of each lane in use.
+		std::vector<float> components[COMPONENT_COUNT]; // Padded to a whole number of blocks.
+		std::vector<glm::mat4> model_matrices; // One per lane, including padding.
+		std::vector<std::uint32_t> dirty_blocks;
+		std::vector<bool> block_dirty; // True if the block is in dirty_blocks.
+		std::vector<std::uint8_t> lane_changed; // Set since the last update, a lane of a dirty block may be unchanged.
+
+		std::unordered_map<GUID, GUID> parents; // Only entities with a parent.
+		bool hierarchy_changed; // Set when the next update must rebuild hierarchy from parents.
+		std::vector<HierarchyNode> hierarchy; // Parents are before their children.
+		std::unordered_map<GUID, std::uint32_t> hierarchy_indices; // Entity to index in hierarchy, live nodes only.
+		std::vector<std::uint32_t> lane_nodes; // Index in hierarchy of each lane, or NO_INDEX.
+		std::vector<glm::mat4> world_matrices; // One per hierarchy node.
+		std::vector<std::uint8_t> node_moved; // Nodes added, moved or relinked since the last update.
+		size_t dead_nodes;
+		std::vector<std::uint8_t> node_changed; // Scratch for UpdateWorldMatrices().
+		std::vector<std::pair<GUID, GUID>> links; // Scratch for RebuildHierarchy(), (parent, child) pairs.
+		// Scratch for MoveSubtree(), each moved node and the index of its parent once moved.
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> subtree;
+		size_t world_matrix_updates;
+	};
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -10,17 +13,30 @@ namespace vv {
 	enum TRANSFORM_COMMAND { TRANSFORM_ADDED, TRANSFORM_UPDATED, TRANSFORM_REMOVED };
 
 	class Transform;
-	typedef Multiton<GUID, std::shared_ptr<Transform>> TransformMap;
+	typedef DenseMultiton<GUID, std::shared_ptr<Transform>> TransformMap;
 
 	static glm::vec3 FORWARD_VECTOR(0.0f, 0.0f, -1.0f);
 	static glm::vec3 UP_VECTOR(0.0f, 1.0f, 0.0f);
 	static glm::vec3 RIGHT_VECTOR(1.0f, 0.0f, 0.0f);
 
+	/* An entity's translation, rotation and scale.
+	*
+	* The fields aren't synchronized, the render system reads them during
+	* RenderSystem::Update(). Only change a transform from the thread that
+	* runs the render system, between updates. Only the dirty list itself
+	* is safe to touch from several threads.
+	*/
 	class Transform final {
 	public:
 		Transform() : Transform(0) { };
 
 		Transform(GUID entity_id);
+
+		// Not copyable, the dirty flag is atomic and a copy of a dirty transform wouldn't be on the dirty list. Create a
+		// new transform for the entity instead.
+		Transform(const Transform&) = delete;
+		Transform& operator=(const Transform&) = delete;
+
 		/**
 		 * \brief Translates by the provided amount relative to the current translation.
 		 *
@@ -122,12 +138,66 @@ namespace vv {
 		GUID GetEntityID() const {
 			return this->entity_id;
 		}
+
+		/**
+		 * \brief Sets the parent entity, this transform is then relative to the parent's.
+		 *
+		 * A parent that is also a descendant is ignored by the render system.
+		 * \param[in] const GUID parent_id The parent entity, 0 for none.
+		 */
+		void SetParent(const GUID parent_id);
+
+		/**
+		 * \brief Returns the parent entity.
+		 *
+		 * \return GUID The parent entity, 0 if there is none.
+		 */
+		GUID GetParent() const {
+			return this->parent_id;
+		}
+
+		/**
+		 * \brief Returns true if the transform changed since its dirty flag was last cleared.
+		 *
+		 * Every mutator above marks the transform dirty, as does constructing it with an entity ID.
+		 * \return bool True if the transform is dirty.
+		 */
+		bool IsDirty() const {
+			return this->dirty;
+		}
+
+		/**
+		 * \brief Clears the dirty flag, call before reading the transform so later changes mark it again.
+		 *
+		 * \return void
+		 */
+		void ClearDirty() {
+			this->dirty = false;
+		}
+
+		/**
+		 * \brief Moves the entities whose transforms became dirty since the last call into entity_ids.
+		 *
+		 * A transform is listed once when it becomes dirty, however many times it changes before its flag is cleared,
+		 * so the caller must keep any entity it can't resolve yet and retry it rather than drop it. The list is locked,
+		 * but the transforms' fields are not, see the class comment.
+		 * \param[out] std::vector<GUID>& entity_ids Cleared, then filled with the dirty entities.
+		 * \return void
+		 */
+		static void TakeDirtyList(std::vector<GUID>& entity_ids);
 	private:
+		void MarkDirty();
+
 		glm::vec3 translation;
 		glm::vec3 rotation;
 		glm::vec3 scale;
 		glm::quat orientation;
 		GUID entity_id;
+		GUID parent_id;
+		std::atomic<bool> dirty;
+
+		static std::mutex dirty_list_mutex;
+		static std::vector<GUID> dirty_list; // Entities that became dirty since the last TakeDirtyList().
 	};
 
 }
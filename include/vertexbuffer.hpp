@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <memory>
+#include <cstddef>
+#include <cstring>
 
 #include "multiton.hpp"
 
@@ -13,7 +15,7 @@
 
 namespace vv {
 	struct VertexBuffer;
-	typedef Multiton<GUID, std::shared_ptr<VertexBuffer>> VertexBufferMap;
+	typedef DenseMultiton<GUID, std::shared_ptr<VertexBuffer>> VertexBufferMap;
 
 	// TODO: Move to Mesh class file
 	struct Vertex {
@@ -25,10 +27,96 @@ namespace vv {
 		float color[3];
 	};
 
+	// Compact vertex layout for voxel meshes (8 bytes instead of 24).
+	struct PackedVertex {
+		PackedVertex(const GLshort x = 0, const GLshort y = 0, const GLshort z = 0, const GLushort color = 0) : color(color) {
+			this->position[0] = x; this->position[1] = y; this->position[2] = z;
+		}
+		GLshort position[3]; // Voxel corner on the integer lattice, the model space position is position * 2 - 1.
+		GLushort color; // Index into the mesh's color palette.
+	};
+
 	// Holds vertex and index buffer "names".
 	struct VertexBuffer {
-		VertexBuffer() : vao(0), vbo(0), ibo(0), vertex_count(0), index_count(0) { }
+		VertexBuffer() : vao(0), vbo(0), ibo(0), instance_vbo(0), vertex_count(0), index_count(0),
+			index_type(GL_UNSIGNED_INT), vertex_capacity(0), index_capacity(0), instance_capacity(0) { }
+
 		void Buffer(const std::vector<Vertex>& verts, const std::vector<GLuint>& indicies) {
+			Bind();
+			Upload(GL_ARRAY_BUFFER, verts.size() ? &verts[0] : nullptr, verts.size() * sizeof(Vertex), this->vertex_capacity);
+			this->vertex_count = verts.size();
+
+			glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, position));
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer((GLuint)1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, color));
+			glEnableVertexAttribArray(1);
+
+			BufferIndicies(indicies);
+			glBindVertexArray(0);
+		}
+
+		// Buffers a voxel mesh, use with a shader that takes integer attributes (see voxel.vert).
+		void Buffer(const std::vector<PackedVertex>& verts, const std::vector<GLuint>& indicies) {
+			Bind();
+			Upload(GL_ARRAY_BUFFER, verts.size() ? &verts[0] : nullptr, verts.size() * sizeof(PackedVertex), this->vertex_capacity);
+			this->vertex_count = verts.size();
+
+			glVertexAttribIPointer((GLuint)0, 3, GL_SHORT, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, position));
+			glEnableVertexAttribArray(0);
+			glVertexAttribIPointer((GLuint)1, 1, GL_UNSIGNED_SHORT, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, color));
+			glEnableVertexAttribArray(1);
+
+			BufferIndicies(indicies);
+			glBindVertexArray(0);
+		}
+
+		/**
+		 * \brief Streams one model matrix per instance, for drawing with glDrawElementsInstanced().
+		 *
+		 * A mat4 attribute takes 4 locations, one per column, so attribute and the 3 after it are set up with a
+		 * divisor of 1 (see voxel-instanced.vert). The buffer is orphaned and rewritten every call, so groups sharing
+		 * this VertexBuffer can each stream their own matrices before their draw without waiting on the previous one.
+		 * \param[in] const GLuint attribute The location of the shader's mat4 instance attribute.
+		 * \param[in] const GLfloat* matrices count column major 4x4 matrices.
+		 * \param[in] const size_t count The number of instances.
+		 * \return void
+		 */
+		void BufferInstances(const GLuint attribute, const GLfloat* matrices, const size_t count) {
+			if (!this->instance_vbo) {
+				glGenBuffers(1, &this->instance_vbo);
+			}
+			Bind();
+			glBindBuffer(GL_ARRAY_BUFFER, this->instance_vbo);
+			const size_t bytes = count * 16 * sizeof(GLfloat);
+			if (this->instance_capacity < bytes) {
+				this->instance_capacity = bytes;
+			}
+			// A draw queued earlier may still read the old matrices. Orphaning hands the driver fresh storage for these
+			// rather than overwriting (or stalling on) the old.
+			glBufferData(GL_ARRAY_BUFFER, this->instance_capacity, nullptr, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, matrices);
+
+			for (GLuint column = 0; column < 4; ++column) {
+				glVertexAttribPointer(attribute + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+					(GLvoid*)(column * 4 * sizeof(GLfloat)));
+				glEnableVertexAttribArray(attribute + column);
+				glVertexAttribDivisor(attribute + column, 1);
+			}
+		}
+
+		// Sets the color palette (RGB triples) PackedVertex::color indexes into.
+		void SetPalette(const std::vector<GLfloat>& rgb) {
+			this->palette = rgb;
+		}
+
+		GLuint vao, vbo, ibo;
+		GLuint instance_vbo; // Per instance model matrices, see BufferInstances().
+		size_t vertex_count;
+		size_t index_count;
+		GLenum index_type; // GL_UNSIGNED_SHORT when every index fits, otherwise GL_UNSIGNED_INT.
+		std::vector<GLfloat> palette;
+	private:
+		void Bind() {
 			if (!this->vao) {
 				glGenVertexArrays(1, &this->vao);
 			}
@@ -41,46 +129,51 @@ namespace vv {
 
 			glBindVertexArray(this->vao);
 			glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
-			// If the size hasn't changed we can call update
-			if (this->vertex_count >= verts.size()) {
-				auto* buffer = glMapBufferRange(GL_ARRAY_BUFFER, 0, verts.size() * sizeof(Vertex), GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
-				if (buffer) {
-					memcpy(buffer, &verts[0], verts.size() * sizeof(Vertex));
-					glUnmapBuffer(GL_ARRAY_BUFFER);
-				}
-				else {
-					//std::err << "glMapBufferRange() failed" << __LINE__ << __FILE__ << std::endl;
-				}
+		}
+
+		// Indices are narrowed to 16 bits when the vertex count allows it, halving the upload.
+		void BufferIndicies(const std::vector<GLuint>& indicies) {
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo);
+			if (this->vertex_count <= 0xFFFF) {
+				this->short_indicies.assign(indicies.begin(), indicies.end());
+				Upload(GL_ELEMENT_ARRAY_BUFFER, this->short_indicies.size() ? &this->short_indicies[0] : nullptr,
+					this->short_indicies.size() * sizeof(GLushort), this->index_capacity);
+				this->index_type = GL_UNSIGNED_SHORT;
 			}
 			else {
-				glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(Vertex), &verts[0], GL_STATIC_DRAW);
-				this->vertex_count = verts.size();
+				Upload(GL_ELEMENT_ARRAY_BUFFER, indicies.size() ? &indicies[0] : nullptr, indicies.size() * sizeof(GLuint),
+					this->index_capacity);
+				this->index_type = GL_UNSIGNED_INT;
 			}
+			this->index_count = indicies.size();
+		}
 
-			glVertexAttribPointer((GLuint)0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, position));
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer((GLuint)1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, color));
-			glEnableVertexAttribArray(1);
-
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ibo);
-			if (this->index_count >= indicies.size()) {
-				auto* buffer = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indicies.size() * sizeof(GLuint), GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		// Writes into the bound buffer, reusing its storage if it is big enough.
+		static void Upload(const GLenum target, const void* data, const size_t bytes, size_t& capacity) {
+			if (!bytes) {
+				return;
+			}
+			// If the data still fits we can map the existing storage. Invalidating lets the driver orphan storage a
+			// pending draw still reads, it isn't unsynchronized since nothing fences those draws.
+			if (capacity >= bytes) {
+				auto* buffer = glMapBufferRange(target, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
 				if (buffer) {
-					memcpy(buffer, &indicies[0], indicies.size() * sizeof(Vertex));
-					glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+					memcpy(buffer, data, bytes);
+					glUnmapBuffer(target);
 				}
 				else {
 					//std::err << "glMapBufferRange() failed" << __LINE__ << __FILE__ << std::endl;
 				}
 			}
 			else {
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicies.size() * sizeof(GLuint), &indicies[0], GL_STATIC_DRAW);
-				this->index_count = indicies.size();
+				glBufferData(target, bytes, data, GL_STATIC_DRAW);
+				capacity = bytes;
 			}
-			glBindVertexArray(0);
 		}
-		GLuint vao, vbo, ibo;
-		size_t vertex_count;
-		size_t index_count;
+
+		size_t vertex_capacity; // Bytes allocated for the vertex buffer.
+		size_t index_capacity; // Bytes allocated for the index buffer.
+		size_t instance_capacity; // Bytes allocated for the instance buffer.
+		std::vector<GLushort> short_indicies; // Narrowed indices, reused by each upload so it doesn't allocate once warmed up.
 	};
 }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+
+#include "voxelchunk.hpp"
+
+namespace vv {
+	/* A small dense block of voxels that can be pasted into a VoxelVolume.
+	*
+	* Each voxel is empty or refers to one of the brush's distinct materials.
+	* Empty voxels are transparent, pasting leaves the volume under them as is.
+	*/
+	class VoxelBrush {
+	public:
+		// Largest edge length of a brush, bigger sizes are clamped to it.
+		static const int MAX_SIZE = 256;
+
+		// Negative sizes are treated as 0 (an empty brush pastes nothing) and sizes past MAX_SIZE are clamped.
+		VoxelBrush(const int rows, const int columns, const int slices) {
+			this->size[0] = ClampSize(rows); this->size[1] = ClampSize(columns); this->size[2] = ClampSize(slices);
+			this->voxels.assign(static_cast<size_t>(this->size[0]) * this->size[1] * this->size[2], -1);
+		}
+
+		// Returns the number of voxels along the row (0), column (1) or slice (2) axis.
+		int GetSize(const int axis) const {
+			return this->size[axis];
+		}
+
+		// Sets the voxel at (row, column, slice) to material. Coordinates must be inside the brush.
+		void Set(const int row, const int column, const int slice, const Voxel& material) {
+			int slot = 0;
+			while (slot < static_cast<int>(this->materials.size()) && !(this->materials[slot] == material)) {
+				++slot;
+			}
+			if (slot == static_cast<int>(this->materials.size())) {
+				this->materials.push_back(material);
+			}
+			this->voxels[Index(row, column, slice)] = slot;
+		}
+
+		void Clear(const int row, const int column, const int slice) {
+			this->voxels[Index(row, column, slice)] = -1;
+		}
+
+		// Returns the index into GetMaterials() of the voxel at (row, column, slice), or -1 if it is empty.
+		int GetSlot(const int row, const int column, const int slice) const {
+			return this->voxels[Index(row, column, slice)];
+		}
+
+		// Returns the distinct materials used by the brush.
+		const std::vector<Voxel>& GetMaterials() const {
+			return this->materials;
+		}
+	private:
+		static int ClampSize(const int size) {
+			return size < 0 ? 0 : (size > MAX_SIZE ? MAX_SIZE : size);
+		}
+
+		int Index(const int row, const int column, const int slice) const {
+			return column + (row + slice * this->size[0]) * this->size[1];
+		}
+
+		int size[3];
+		std::vector<int> voxels; // Material slot per voxel (-1 if empty), column fastest then row then slice.
+		std::vector<Voxel> materials;
+	};
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "voxelchunk.hpp"
+
+namespace vv {
+	/* A sparse voxel octree over the whole signed 16-bit coordinate space.
+	*
+	* Every node is either a branch with 8 children or uniform, meaning every
+	* voxel it covers is empty or solid with the same material. Uniform
+	* subtrees are collapsed into a single node after each edit, so large
+	* empty or single material regions cost one node no matter their size.
+	*
+	* Nodes are a single 32-bit word. A branch holds BRANCH_BIT and the index
+	* of its first child (children are stored in contiguous blocks of 8), a
+	* uniform node holds 0 for empty or the material ID + 1.
+	*/
+	class VoxelOctree {
+	public:
+		static const int DEPTH = 16; // Levels below the root, the root covers 2^16 voxels per axis.
+
+		// Visited with the first voxel (row, column, slice) and edge length of a solid uniform node and its material.
+		typedef std::function<void(const int row, const int column, const int slice, const int size,
+			const std::uint16_t material)> SolidVisitor;
+
+		VoxelOctree();
+
+		// Returns true if the voxel at (row, column, slice) is solid.
+		bool IsSolid(const short row, const short column, const short slice) const {
+			return Get(row, column, slice) != EMPTY;
+		}
+
+		// Returns the material ID of the voxel at (row, column, slice). Only meaningful for solid voxels.
+		std::uint16_t GetMaterial(const short row, const short column, const short slice) const {
+			std::uint32_t value = Get(row, column, slice);
+			return value == EMPTY ? 0 : static_cast<std::uint16_t>(value - 1);
+		}
+
+		/**
+		* \brief Marks the voxel solid with the given material.
+		*
+		* \param[in] const short row, column, slice The voxel.
+		* \param[in] const std::uint16_t material The material ID.
+		* \return bool True if the voxel was previously empty.
+		*/
+		bool Set(const short row, const short column, const short slice, const std::uint16_t material) {
+			return Store(row, column, slice, static_cast<std::uint32_t>(material) + 1) == EMPTY;
+		}
+
+		/**
+		* \brief Marks the voxel empty.
+		*
+		* \param[in] const short row, column, slice The voxel.
+		* \return bool True if the voxel was previously solid.
+		*/
+		bool Clear(const short row, const short column, const short slice) {
+			return Store(row, column, slice, EMPTY) != EMPTY;
+		}
+
+		/**
+		* \brief Sets every voxel in the box from min to max (inclusive, as row, column, slice) to material.
+		*
+		* Nodes entirely inside the box are replaced whole instead of voxel by voxel.
+		* \param[in] const int min[3] The first voxel of the box.
+		* \param[in] const int max[3] The last voxel of the box.
+		* \param[in] const std::uint16_t material The material ID.
+		* \return long long The change in the number of solid voxels.
+		*/
+		long long FillBox(const int min[3], const int max[3], const std::uint16_t material) {
+			return StoreBox(min, max, static_cast<std::uint32_t>(material) + 1);
+		}
+
+		// Marks every voxel in the box empty, see FillBox().
+		long long ClearBox(const int min[3], const int max[3]) {
+			return StoreBox(min, max, EMPTY);
+		}
+
+		/**
+		* \brief Visits every solid uniform node overlapping the box from min to max (inclusive, as row, column, slice).
+		*
+		* Nodes are visited whole, so they may extend past the box.
+		* \param[in] const int min[3] The first voxel of the box.
+		* \param[in] const int max[3] The last voxel of the box.
+		* \param[in] const SolidVisitor& visit Called once per solid node.
+		* \return void
+		*/
+		void ForEachSolid(const int min[3], const int max[3], const SolidVisitor& visit) const;
+
+		/**
+		* \brief Fills chunk with the voxels of the chunk sized block starting at base.
+		*
+		* \param[in] const int base[3] The first voxel of the block, aligned to VoxelChunk::SIZE.
+		* \param[out] VoxelChunk& chunk The chunk to fill, its previous contents are discarded.
+		* \return bool False if the block is empty.
+		*/
+		bool ExtractChunk(const int base[3], VoxelChunk& chunk) const;
+
+		// Fills only the occupancy bits of the chunk sized block starting at base.
+		void ExtractOccupancy(const int base[3], std::uint64_t occupancy[VoxelChunk::WORD_COUNT]) const;
+
+		// Visits the first voxel of every chunk sized block that holds solid voxels. With skip_buried, blocks inside a
+		// larger solid node (which can't have exposed faces) are skipped and only its outer shell of blocks is visited.
+		void ForEachChunk(const std::function<void(const int row, const int column, const int slice)>& visit,
+			const bool skip_buried) const;
+
+		// Returns the number of allocated nodes, including free blocks awaiting reuse.
+		size_t GetNodeCount() const {
+			return this->nodes.size();
+		}
+
+		// Returns the bytes allocated by the node storage.
+		size_t GetMemoryBytes() const {
+			return this->nodes.capacity() * sizeof(std::uint32_t) + this->free_blocks.capacity() * sizeof(std::uint32_t);
+		}
+	private:
+		static const std::uint32_t BRANCH_BIT = 0x80000000u;
+		static const std::uint32_t EMPTY = 0;
+
+		// Maps a signed coordinate to the tree's unsigned space, keeping the order.
+		static std::uint32_t Bias(const int coord) {
+			return static_cast<std::uint16_t>(coord) ^ 0x8000u;
+		}
+
+		static int Unbias(const std::uint32_t coord) {
+			return static_cast<short>(static_cast<std::uint16_t>(coord ^ 0x8000u));
+		}
+
+		static int ChildIndex(const std::uint32_t u[3], const int bit) {
+			return static_cast<int>(((u[1] >> bit) & 1) | (((u[0] >> bit) & 1) << 1) | (((u[2] >> bit) & 1) << 2));
+		}
+
+		std::uint32_t Get(const short row, const short column, const short slice) const;
+
+		// Stores value at the voxel, splitting and collapsing nodes as needed. Returns the previous value.
+		std::uint32_t Store(const short row, const short column, const short slice, const std::uint32_t value);
+
+		long long StoreBox(const int min[3], const int max[3], const std::uint32_t value);
+
+		// Stores value over the part of the box inside node. Returns the change in the number of solid voxels.
+		long long StoreBoxNode(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+			const std::uint32_t min[3], const std::uint32_t max[3], const std::uint32_t value);
+
+		// Returns the number of solid voxels under node.
+		long long CountSolid(const std::uint32_t node, const int size_bits) const;
+
+		// Puts every block below node on the free list.
+		void ReleaseChildren(const std::uint32_t node);
+
+		// Returns the index of a new block of 8 children all set to value.
+		std::uint32_t AllocateBlock(const std::uint32_t value);
+
+		void VisitSolid(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+			const std::uint32_t min[3], const std::uint32_t max[3], const SolidVisitor& visit) const;
+
+		void VisitChunks(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+			const std::function<void(const int row, const int column, const int slice)>& visit, const bool skip_buried) const;
+
+		std::vector<std::uint32_t> nodes; // nodes[0] is the root.
+		std::vector<std::uint32_t> free_blocks; // First child index of each released block.
+	};
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "voxelvolume.hpp"
+#include "worker-pool.hpp"
+
+namespace vv {
+	// Counts from a single VoxelVolumeManager::Update().
+	struct VolumeUpdateStats {
+		VolumeUpdateStats() : volume_count(0), volumes_updated(0), commands_routed(0), commands_unrouted(0),
+			commands_deferred(0), update_time_ms(0.0) { }
+		size_t volume_count;
+		size_t volumes_updated; // Volumes that had commands to run or chunks to remesh.
+		size_t commands_routed;
+		size_t commands_unrouted; // Commands for entities without a volume, these are discarded.
+		size_t commands_deferred; // Routed commands left for the next update by volumes over their command budget.
+		double update_time_ms; // Wall time spent in Update().
+
+		// Returns the routed commands run per second, 0 if nothing was routed.
+		double CommandsPerSecond() const {
+			return this->update_time_ms > 0.0 ? (this->commands_routed - this->commands_deferred) * 1000.0 /
+				this->update_time_ms : 0.0;
+		}
+	};
+
+	/* Owns one VoxelVolume per entity and updates them all from the shared voxel command queue.
+	*
+	* Every volume shares CommandQueue<VOXEL_COMMAND>'s single queue, so
+	* instead of each volume draining it the manager splits the queued
+	* commands by entity_id and hands each volume only its own, in the
+	* order they were queued. The volumes don't share any state, so they
+	* then run their commands and remesh concurrently, one volume per job.
+	* Each volume's command budget applies to its own commands.
+	*
+	* Volumes owned by a manager must not be updated on their own, their
+	* Update() would run every entity's commands.
+	*/
+	class VoxelVolumeManager {
+	public:
+		// Sets how many threads (including the calling thread) update volumes. Defaults to 1 (serial).
+		explicit VoxelVolumeManager(const size_t thread_count = 1);
+		~VoxelVolumeManager();
+
+		/**
+		* \brief Creates the volume that receives the commands queued for entity_id.
+		*
+		* Returns the existing volume if entity_id already has one.
+		* \param[in] const GUID entity_id The entity the volume belongs to.
+		* \param[in] const VOXEL_STORAGE storage The storage backend of a new volume.
+		* \return VoxelVolume* The entity's volume, owned by the manager.
+		*/
+		VoxelVolume* AddVolume(const GUID entity_id, const VOXEL_STORAGE storage = STORAGE_CHUNKS);
+
+		// Destroys the entity's volume. Commands still queued for it are discarded by the next Update().
+		void RemoveVolume(const GUID entity_id);
+
+		// Returns the entity's volume or nullptr if it doesn't have one.
+		VoxelVolume* GetVolume(const GUID entity_id) const;
+
+		size_t GetVolumeCount() const {
+			return this->volumes.size();
+		}
+
+		// Sets how many threads (including the calling thread) update volumes.
+		void SetThreadCount(const size_t thread_count);
+
+		size_t GetThreadCount() const {
+			return this->pool->GetThreadCount();
+		}
+
+		// Routes every queued voxel command to its entity's volume, then runs the commands and remeshes each volume
+		// that changed, spread across the worker threads.
+		void Update(double delta);
+
+		// Returns the counts from the last call to Update().
+		const VolumeUpdateStats& GetUpdateStats() const {
+			return this->update_stats;
+		}
+	private:
+		struct ManagedVolume {
+			std::unique_ptr<VoxelVolume> volume;
+			std::vector<Command<VOXEL_COMMAND>*> commands; // This update's commands, still owned by the queue.
+		};
+
+		std::unordered_map<GUID, ManagedVolume> volumes;
+		std::vector<ManagedVolume*> updating; // Volumes with work this update, one job each.
+		std::unique_ptr<WorkerPool> pool;
+		VolumeUpdateStats update_stats;
+	};
+}
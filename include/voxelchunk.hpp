@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace vv {
+	// A voxel material. VoxelVolume keeps one copy of each distinct material and voxels refer to it by index.
+	struct Voxel {
+		Voxel() {
+			this->color[0] = 1.0f; this->color[1] = 1.0f; this->color[2] = 1.0f;
+		}
+		Voxel(const float r, const float g, const float b) {
+			this->color[0] = r; this->color[1] = g; this->color[2] = b;
+		}
+		bool operator==(const Voxel& other) const {
+			return this->color[0] == other.color[0] && this->color[1] == other.color[1] && this->color[2] == other.color[2];
+		}
+		float color[3];
+	};
+
+	/* A fixed size cube of voxels.
+	*
+	* Occupancy is stored as a bitmask (one bit per voxel). Each solid voxel
+	* also has a material, stored as an index into a small per chunk palette of
+	* volume material IDs. The indices are bit packed and their width (0, 1, 2,
+	* 4, 8 or 16 bits) follows the number of distinct materials in the chunk,
+	* so a chunk of a single material stores no indices at all. The width
+	* grows as soon as a material doesn't fit but only shrinks once less than
+	* half of its slots are in use, so edits near a boundary don't repack.
+	*
+	* Voxels are laid out with the column (x) varying fastest, then the row
+	* (y), then the slice (z), so each 64-bit occupancy word holds 4 rows of a
+	* single slice.
+	*/
+	class VoxelChunk {
+	public:
+		static const int SIZE_BITS = 4;
+		static const int SIZE = 1 << SIZE_BITS; // Voxels along each axis.
+		static const int VOLUME = SIZE * SIZE * SIZE;
+		static const int WORD_COUNT = VOLUME / 64;
+
+		VoxelChunk() : solid_count(0), index_bits(0) {
+			memset(this->occupancy, 0, sizeof(this->occupancy));
+		}
+
+		// Returns the dense index for the local (row, column, slice) position. Each must be in [0, SIZE).
+		static int Index(const int row, const int column, const int slice) {
+			return column + (row << SIZE_BITS) + (slice << (SIZE_BITS * 2));
+		}
+
+		static int Row(const int index) {
+			return (index >> SIZE_BITS) & (SIZE - 1);
+		}
+
+		static int Column(const int index) {
+			return index & (SIZE - 1);
+		}
+
+		static int Slice(const int index) {
+			return index >> (SIZE_BITS * 2);
+		}
+
+		bool IsSolid(const int index) const {
+			return ((this->occupancy[index >> 6] >> (index & 63)) & 1) != 0;
+		}
+
+		/**
+		* \brief Marks the voxel at index solid and sets its material.
+		*
+		* The index storage is widened and repacked if the chunk runs out of palette slots.
+		* \param[in] const int index The dense index of the voxel.
+		* \param[in] const std::uint16_t material The volume material ID of the voxel.
+		* \return bool True if the voxel was previously empty.
+		*/
+		bool Set(const int index, const std::uint16_t material) {
+			bool was_solid = IsSolid(index);
+			if (was_solid) {
+				int old_local = GetLocal(index);
+				if (this->palette[old_local] == material) {
+					return false;
+				}
+				--this->palette_counts[old_local];
+			}
+
+			SetLocal(index, FindOrAddLocal(material));
+			if (was_solid) {
+				ShrinkIfSparse();
+				return false;
+			}
+			this->occupancy[index >> 6] |= std::uint64_t(1) << (index & 63);
+			++this->solid_count;
+			return true;
+		}
+
+		/**
+		* \brief Marks the voxel at index empty.
+		*
+		* The index storage is narrowed and repacked once the remaining materials use less than half of its palette slots.
+		* \param[in] const int index The dense index of the voxel.
+		* \return bool True if the voxel was previously solid.
+		*/
+		bool Clear(const int index) {
+			if (!IsSolid(index)) {
+				return false;
+			}
+			--this->palette_counts[GetLocal(index)];
+			this->occupancy[index >> 6] &= ~(std::uint64_t(1) << (index & 63));
+			--this->solid_count;
+			ShrinkIfSparse();
+			return true;
+		}
+
+		// Marks every voxel empty. Allocations are kept so a scratch chunk can be refilled cheaply.
+		void Reset() {
+			memset(this->occupancy, 0, sizeof(this->occupancy));
+			this->palette.clear();
+			this->palette_counts.clear();
+			this->indices.clear();
+			this->solid_count = 0;
+			this->index_bits = 0;
+		}
+
+		// Returns the volume material ID of the voxel at index. Only meaningful for solid voxels.
+		std::uint16_t GetMaterial(const int index) const {
+			return this->palette.empty() ? 0 : this->palette[GetLocal(index)];
+		}
+
+		const std::uint64_t* GetOccupancy() const {
+			return this->occupancy;
+		}
+
+		int GetSolidCount() const {
+			return this->solid_count;
+		}
+
+		bool IsEmpty() const {
+			return this->solid_count == 0;
+		}
+
+		// Returns the width in bits of each voxel's palette index.
+		int GetIndexBits() const {
+			return this->index_bits;
+		}
+
+		// Returns the number of palette slots (some may be unused until the next repack).
+		size_t GetPaletteSize() const {
+			return this->palette.size();
+		}
+
+		// Returns the bytes allocated outside the chunk object for the palette and packed indices.
+		size_t GetHeapBytes() const {
+			return this->palette.capacity() * sizeof(std::uint16_t) + this->palette_counts.capacity() * sizeof(std::uint16_t) +
+				this->indices.capacity() * sizeof(std::uint64_t);
+		}
+	private:
+		// The narrowest supported index width that can address count palette slots.
+		static int BitsFor(const size_t count) {
+			int bits = 0;
+			while ((size_t(1) << bits) < count) {
+				bits = bits ? bits * 2 : 1;
+			}
+			return bits;
+		}
+
+		int GetLocal(const int index) const {
+			if (!this->index_bits) {
+				return 0;
+			}
+			int bit = index * this->index_bits;
+			return static_cast<int>((this->indices[bit >> 6] >> (bit & 63)) & ((std::uint64_t(1) << this->index_bits) - 1));
+		}
+
+		void SetLocal(const int index, const int local) {
+			if (!this->index_bits) {
+				return;
+			}
+			int bit = index * this->index_bits;
+			std::uint64_t mask = ((std::uint64_t(1) << this->index_bits) - 1) << (bit & 63);
+			this->indices[bit >> 6] = (this->indices[bit >> 6] & ~mask) | (static_cast<std::uint64_t>(local) << (bit & 63));
+		}
+
+		// Returns the palette slot for material, reusing a free slot or growing the palette (and index width) if needed.
+		int FindOrAddLocal(const std::uint16_t material) {
+			int free_slot = -1;
+			for (size_t local = 0; local < this->palette.size(); ++local) {
+				if (this->palette_counts[local] == 0) {
+					if (free_slot < 0) {
+						free_slot = static_cast<int>(local);
+					}
+				}
+				else if (this->palette[local] == material) {
+					++this->palette_counts[local];
+					return static_cast<int>(local);
+				}
+			}
+			if (free_slot < 0) {
+				free_slot = static_cast<int>(this->palette.size());
+				this->palette.push_back(material);
+				this->palette_counts.push_back(0);
+				if (BitsFor(this->palette.size()) != this->index_bits) {
+					Repack(BitsFor(this->palette.size()), nullptr);
+				}
+			}
+			this->palette[free_slot] = material;
+			++this->palette_counts[free_slot];
+			return free_slot;
+		}
+
+		// Drops unused palette slots and narrows the indices once the materials in use fill less than half of the current
+		// width's slots. Narrowing as soon as they fit would repack on every edit of a chunk toggling between 2 and 3
+		// materials, so until then freed slots stay in the palette to be reused.
+		void ShrinkIfSparse() {
+			size_t used = 0;
+			for (std::uint16_t count : this->palette_counts) {
+				used += count ? 1 : 0;
+			}
+			if (used != 0 && used * 2 >= (size_t(1) << this->index_bits)) {
+				return;
+			}
+
+			std::vector<int> remap(this->palette.size(), 0);
+			std::vector<std::uint16_t> palette, palette_counts;
+			for (size_t local = 0; local < this->palette.size(); ++local) {
+				if (this->palette_counts[local]) {
+					remap[local] = static_cast<int>(palette.size());
+					palette.push_back(this->palette[local]);
+					palette_counts.push_back(this->palette_counts[local]);
+				}
+			}
+			Repack(BitsFor(palette.size()), &remap);
+			this->palette.swap(palette);
+			this->palette_counts.swap(palette_counts);
+		}
+
+		// Rewrites every index at the given width, passing each through remap if it isn't null.
+		void Repack(const int bits, const std::vector<int>* remap) {
+			std::vector<std::uint64_t> old_indices;
+			old_indices.swap(this->indices);
+			int old_bits = this->index_bits;
+
+			this->index_bits = bits;
+			if (!bits) {
+				return;
+			}
+			this->indices.assign(VOLUME * bits / 64, 0);
+			for (int index = 0; index < VOLUME; ++index) {
+				if (!IsSolid(index)) {
+					continue;
+				}
+				int local = 0;
+				if (old_bits) {
+					int bit = index * old_bits;
+					local = static_cast<int>((old_indices[bit >> 6] >> (bit & 63)) & ((std::uint64_t(1) << old_bits) - 1));
+				}
+				SetLocal(index, remap ? (*remap)[local] : local);
+			}
+		}
+
+		std::uint64_t occupancy[WORD_COUNT];
+		std::vector<std::uint16_t> palette; // Volume material ID of each palette slot.
+		std::vector<std::uint16_t> palette_counts; // Voxels using each palette slot, 0 marks a free slot.
+		std::vector<std::uint64_t> indices; // index_bits per voxel, in dense index order.
+		int solid_count;
+		int index_bits;
+	};
+}
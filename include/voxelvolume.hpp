@@ -1,28 +1,34 @@
 #pragma once
 
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <vector>
 #include <queue>
+#include <memory>
+#include <tuple>
 
 #include "command-queue.hpp"
+#include "voxelchunk.hpp"
+#include "voxel-octree.hpp"
+#include "voxel-brush.hpp"
+#include "morton-key.hpp"
+#include "face-mask.hpp"
+#include "worker-pool.hpp"
 
 namespace vv {
-	struct Vertex;
+	struct PackedVertex;
 
-	struct Voxel {
-		Voxel() {
-			this->neighbors[UP] = nullptr; this->neighbors[DOWN] = nullptr;
-			this->neighbors[LEFT] = nullptr; this->neighbors[RIGHT] = nullptr;
-			this->neighbors[FRONT] = nullptr; this->neighbors[BACK] = nullptr;
-		}
-		enum NEIGHBORS { UP = 0, DOWN, LEFT, RIGHT, FRONT, BACK };
-		float color[3];
-		Voxel* neighbors[6];
+	enum VOXEL_COMMAND {
+		VOXEL_ADD,
+		VOXEL_REMOVE,
+		VOXEL_FILL_BOX, // VoxelBoxCommand
+		VOXEL_CARVE_BOX, // VoxelBoxCommand
+		VOXEL_FILL_SPHERE, // VoxelSphereCommand
+		VOXEL_CARVE_SPHERE, // VoxelSphereCommand
+		VOXEL_PASTE_BRUSH, // VoxelBrushCommand
 	};
 
-	enum VOXEL_COMMAND { VOXEL_ADD, VOXEL_REMOVE };
-
 	struct VoxelCommand : Command < VOXEL_COMMAND > {
 		VoxelCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id, std::tuple<short, short, short> position) :
 			Command(voxel_c, entity_id) {
@@ -30,44 +36,356 @@ namespace vv {
 			this->column = std::get<1>(position);
 			this->slice = std::get<2>(position);
 		}
+		// Adds (or repaints) the voxel with the given material.
+		VoxelCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id, std::tuple<short, short, short, Voxel> voxel) :
+			Command(voxel_c, entity_id), material(std::get<3>(voxel)) {
+			this->row = std::get<0>(voxel);
+			this->column = std::get<1>(voxel);
+			this->slice = std::get<2>(voxel);
+		}
+		short row, column, slice;
+		Voxel material;
+	};
+
+	// Fills or carves every voxel from min to max (inclusive, as row, column, slice).
+	struct VoxelBoxCommand : Command < VOXEL_COMMAND > {
+		VoxelBoxCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id, std::tuple<short, short, short, short, short, short> box) :
+			Command(voxel_c, entity_id) {
+			SetBox(box);
+		}
+		VoxelBoxCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id,
+			std::tuple<short, short, short, short, short, short, Voxel> box) : Command(voxel_c, entity_id), material(std::get<6>(box)) {
+			SetBox(std::make_tuple(std::get<0>(box), std::get<1>(box), std::get<2>(box), std::get<3>(box), std::get<4>(box),
+				std::get<5>(box)));
+		}
+		short min[3], max[3];
+		Voxel material;
+	private:
+		void SetBox(const std::tuple<short, short, short, short, short, short>& box) {
+			this->min[0] = std::get<0>(box); this->min[1] = std::get<1>(box); this->min[2] = std::get<2>(box);
+			this->max[0] = std::get<3>(box); this->max[1] = std::get<4>(box); this->max[2] = std::get<5>(box);
+		}
+	};
+
+	// Fills or carves every voxel within radius of the center (row, column, slice).
+	struct VoxelSphereCommand : Command < VOXEL_COMMAND > {
+		VoxelSphereCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id, std::tuple<short, short, short, short> sphere) :
+			Command(voxel_c, entity_id) {
+			this->row = std::get<0>(sphere);
+			this->column = std::get<1>(sphere);
+			this->slice = std::get<2>(sphere);
+			this->radius = std::get<3>(sphere);
+		}
+		VoxelSphereCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id, std::tuple<short, short, short, short, Voxel> sphere) :
+			Command(voxel_c, entity_id), material(std::get<4>(sphere)) {
+			this->row = std::get<0>(sphere);
+			this->column = std::get<1>(sphere);
+			this->slice = std::get<2>(sphere);
+			this->radius = std::get<3>(sphere);
+		}
+		short row, column, slice, radius;
+		Voxel material;
+	};
+
+	// Pastes the solid voxels of a brush with its first voxel at (row, column, slice).
+	// The brush is shared so one brush can be stamped many times without copying it.
+	struct VoxelBrushCommand : Command < VOXEL_COMMAND > {
+		VoxelBrushCommand(const VOXEL_COMMAND voxel_c, const GUID entity_id,
+			std::tuple<short, short, short, std::shared_ptr<const VoxelBrush>> paste) : Command(voxel_c, entity_id),
+			brush(std::get<3>(paste)) {
+			this->row = std::get<0>(paste);
+			this->column = std::get<1>(paste);
+			this->slice = std::get<2>(paste);
+		}
 		short row, column, slice;
+		std::shared_ptr<const VoxelBrush> brush;
+	};
+
+	enum MESH_MODE {
+		MESH_CUBES, // Every face of every voxel.
+		MESH_CULLED, // Only faces not pressed against a solid neighbor.
+		// Exposed faces merged into the largest same material rectangles per slice of a chunk. Quads never cross a
+		// 16 voxel chunk border, so an N x N face becomes at least ceil(N / 16)^2 quads (a 100 x 100 floor is 7 x 7).
+		MESH_GREEDY,
+	};
+
+	enum VOXEL_STORAGE {
+		STORAGE_CHUNKS, // A hash of 16^3 chunks, only chunks holding voxels are allocated.
+		STORAGE_OCTREE, // A sparse voxel octree, uniform regions of any size collapse into a single node.
+	};
+
+	// Counts from the last call to UpdateVertexBuffers().
+	struct MeshStats {
+		MeshStats() : vertex_count(0), index_count(0), triangle_count(0), faces_emitted(0), faces_culled(0),
+			faces_merged(0), chunks_meshed(0), mesh_time_ms(0.0) { }
+		size_t vertex_count;
+		size_t index_count;
+		size_t triangle_count;
+		size_t faces_emitted; // Quads emitted, greedy quads count once.
+		size_t faces_culled; // Faces skipped because a solid neighbor covers them.
+		size_t faces_merged; // Exposed faces folded into a larger greedy quad.
+		size_t chunks_meshed; // Dirty chunks remeshed, the rest reused their cached mesh.
+		double mesh_time_ms; // Wall time spent in UpdateVertexBuffers().
+	};
+
+	// Memory used by a VoxelVolume's voxel storage.
+	struct VoxelMemoryReport {
+		VoxelMemoryReport() : voxel_count(0), chunk_count(0), chunk_bytes(0), octree_node_count(0), octree_bytes(0),
+			hash_map_bytes(0) { }
+		size_t voxel_count;
+		size_t chunk_count;
+		size_t chunk_bytes; // Bytes used by the chunks and the chunk hash.
+		size_t octree_node_count; // Octree nodes allocated (STORAGE_OCTREE only).
+		size_t octree_bytes; // Bytes used by the octree nodes.
+		size_t hash_map_bytes; // Estimated bytes a per voxel hash map (node per voxel with neighbor pointers) would use.
+
+		double ChunkBytesPerVoxel() const {
+			return this->voxel_count ? static_cast<double>(this->chunk_bytes) / this->voxel_count : 0.0;
+		}
+
+		double OctreeBytesPerVoxel() const {
+			return this->voxel_count ? static_cast<double>(this->octree_bytes) / this->voxel_count : 0.0;
+		}
+
+		double HashMapBytesPerVoxel() const {
+			return this->voxel_count ? static_cast<double>(this->hash_map_bytes) / this->voxel_count : 0.0;
+		}
 	};
 
 	class VoxelVolume : public CommandQueue < VOXEL_COMMAND > {
 	public:
-		VoxelVolume();
+		// Palette entries the voxel shaders hold, materials past this share the closest existing color.
+		static const size_t MAX_MATERIALS = 256;
+
+		// Largest row, column or slice a voxel can be added at. The far corner of a voxel is one past its coordinate and
+		// must still fit in a PackedVertex's GLshort position, so edits past this are dropped or clamped.
+		static const short MAX_COORD = 32766;
+
+		// The storage backend is fixed for the life of the volume. Defaults to STORAGE_CHUNKS.
+		explicit VoxelVolume(const VOXEL_STORAGE storage = STORAGE_CHUNKS);
 		~VoxelVolume();
 
 	protected:
 		// All values are relative to the front orientation and centered on the root voxel.
 		// Slize is depth (away from the screen is positive). Row is up/down. Column is left/right.
 		// Therefore adding a voxel to the front face is AddVoxel(0, 0, 1).
-		void AddVoxel(const short row, const short column, const short slice);
+		// Adding over an existing voxel changes its material. Coordinates past MAX_COORD are ignored.
+		void AddVoxel(const short row, const short column, const short slice, const Voxel& material = Voxel());
 
 		// See AddVoxel().
 		void RemoveVoxel(const short row, const short column, const short slice);
 
+		// Region edits are applied a chunk at a time and each touched chunk (and any neighbor sharing a face with the
+		// edited voxels) is marked dirty once, rather than once per voxel.
+
+		// Sets every voxel from min to max (inclusive, as row, column, slice) to material. Adds are clamped to MAX_COORD.
+		void FillBox(const short min[3], const short max[3], const Voxel& material = Voxel());
+
+		// Removes every voxel from min to max (inclusive, as row, column, slice).
+		void CarveBox(const short min[3], const short max[3]);
+
+		// Sets every voxel within radius of (row, column, slice) to material.
+		void FillSphere(const short row, const short column, const short slice, const short radius,
+			const Voxel& material = Voxel());
+
+		// Removes every voxel within radius of (row, column, slice).
+		void CarveSphere(const short row, const short column, const short slice, const short radius);
+
+		// Copies the solid voxels of brush with its first voxel at (row, column, slice). Empty brush voxels are left as is.
+		void PasteBrush(const short row, const short column, const short slice, const VoxelBrush& brush);
+
+		// Runs the queued commands against this volume, whatever their entity_id.
 		void ProcessCommandQueue();
+
+		// Runs commands in order, dropping the ones a later command makes redundant if coalescing is enabled, and
+		// releases each one it runs from the queue. Commands past the command budget are left queued. Voxel edits
+		// don't commute, so none of them are urgent.
+		void ProcessCommands(const std::vector<Command<VOXEL_COMMAND>*>& commands);
+
+		friend class VoxelVolumeManager;
 	public:
-		// Iterates over all the actions queued before the call to update.
+		// Iterates over all the actions queued before the call to update and remeshes any changed chunks.
+		// Runs every entity's commands, use a VoxelVolumeManager to keep several volumes apart.
 		void Update(double delta);
 
-		// Generates a vertex (and index) buffer for the current voxel state.
+		// Remeshes the dirty chunks and rebuilds the vertex (and index) buffer from the cached chunk meshes.
+		// Does nothing if no chunk has changed since the last call.
 		void UpdateVertexBuffers();
 
+		// Returns true if a chunk has changed since the last call to UpdateVertexBuffers().
+		bool IsDirty() const {
+			return !this->dirty_chunks.empty();
+		}
+
+		// Marks every chunk dirty so the next UpdateVertexBuffers() rebuilds the whole mesh.
+		void MarkAllDirty();
+
 		// Returns the vertex buffer.
-		const std::vector<Vertex>& GetVertexBuffer() {
+		const std::vector<PackedVertex>& GetVertexBuffer() {
 			return this->verts;
 		}
 
+		// Returns the RGB triples PackedVertex::color indexes into, one per distinct material in the volume.
+		// Holds at most MAX_MATERIALS entries.
+		const std::vector<float>& GetPalette() const {
+			return this->palette;
+		}
+
+		// Returns the material of the voxel at (row, column, slice), or the default material if it is empty.
+		Voxel GetMaterial(const short row, const short column, const short slice) const;
+
 		// Returns the index buffer.
 		const std::vector<unsigned int>& GetIndexBuffer() {
 			return this->indicies;
 		}
+
+		// Sets how UpdateVertexBuffers() builds the mesh. Defaults to MESH_CULLED.
+		void SetMeshMode(const MESH_MODE mode) {
+			if (this->mesh_mode != mode) {
+				this->mesh_mode = mode;
+				MarkAllDirty();
+			}
+		}
+
+		MESH_MODE GetMeshMode() const {
+			return this->mesh_mode;
+		}
+
+		// Sets how many threads (including the calling thread) mesh dirty chunks. Defaults to 1 (serial).
+		// Chunks are stitched in key order afterwards, so the buffers are identical for every thread count.
+		void SetMeshThreadCount(const size_t thread_count);
+
+		size_t GetMeshThreadCount() const {
+			return this->corner_tables.size();
+		}
+
+		VOXEL_STORAGE GetStorage() const {
+			return this->storage;
+		}
+
+		// Returns the counts from the last call to UpdateVertexBuffers().
+		const MeshStats& GetMeshStats() const {
+			return this->mesh_stats;
+		}
+
+		// Returns true if the voxel at (row, column, slice) is solid.
+		bool IsSolid(const short row, const short column, const short slice) const;
+
+		// Returns the number of solid voxels.
+		size_t GetVoxelCount() const {
+			return this->voxel_count;
+		}
+
+		// Reports the memory used by the voxel storage compared to a per voxel hash map.
+		VoxelMemoryReport GetMemoryReport() const;
 	private:
-		std::unordered_map<long long, Voxel> voxels;
-		std::vector<Vertex> verts;
+		// The mesh generated for a single chunk. Indices are relative to the chunk's own vertices.
+		struct ChunkMesh {
+			ChunkMesh() : faces_emitted(0), faces_culled(0), faces_merged(0) {
+				this->base[0] = 0; this->base[1] = 0; this->base[2] = 0;
+			}
+			int base[3]; // First voxel of the chunk as (row, column, slice).
+			std::vector<PackedVertex> verts;
+			std::vector<unsigned int> indicies;
+			size_t faces_emitted;
+			size_t faces_culled;
+			size_t faces_merged;
+		};
+
+		// Returns the key of the chunk containing the voxel (row, column, slice). Keys are Morton encoded chunk coordinates.
+		static MortonKey ChunkKey(const short row, const short column, const short slice) {
+			return MortonKey::Encode(row >> VoxelChunk::SIZE_BITS, column >> VoxelChunk::SIZE_BITS, slice >> VoxelChunk::SIZE_BITS);
+		}
+
+		// Returns the chunk containing (row, column, slice) or nullptr if there isn't one.
+		VoxelChunk* FindChunk(const short row, const short column, const short slice) const;
+
+		// Returns the volume material ID of material, adding it to the palette if it is new. Once the palette is full
+		// new materials get the ID of the closest existing color instead.
+		std::uint16_t FindMaterial(const Voxel& material);
+
+		// Marks the chunk containing (row, column, slice) dirty, along with any neighboring chunk whose faces touch it.
+		void MarkDirty(const short row, const short column, const short slice);
+
+		// Marks the chunk dirty, along with the neighbors across any chunk face the local box from min to max touches.
+		void MarkDirty(const MortonKey key, const int min[3], const int max[3]);
+
+		// Marks every chunk overlapping the box from min to max (inclusive, as row, column, slice) dirty, see MarkDirty().
+		void MarkRegionDirty(const int min[3], const int max[3]);
+
+		/**
+		* \brief Applies edit to every voxel of the box from min to max (inclusive, as row, column, slice).
+		*
+		* The box is walked one chunk at a time. edit(row, column, slice) returns the material ID to store,
+		* KEEP_VOXEL or CLEAR_VOXEL.
+		* \param[in] const int min[3] The first voxel of the box.
+		* \param[in] const int max[3] The last voxel of the box.
+		* \param[in] const bool adds False if edit never returns a material, so chunks that don't exist are skipped.
+		* \param[in] Edit edit The per voxel edit.
+		* \return void
+		*/
+		template <typename Edit>
+		void EditRegion(const int min[3], const int max[3], const bool adds, Edit edit);
+		static const int KEEP_VOXEL = -1;
+		static const int CLEAR_VOXEL = -2;
+
+		// Number of corner lattice points along each axis of a chunk.
+		static const int CORNER_SIZE = VoxelChunk::SIZE + 1;
+
+		// Vertex index of each corner of the chunk being meshed, valid where stamp matches generation.
+		// Each meshing thread has its own so chunks can be meshed concurrently.
+		struct CornerTable {
+			CornerTable() : generation(0) {
+				memset(this->stamp, 0, sizeof(this->stamp));
+			}
+			unsigned int index[CORNER_SIZE * CORNER_SIZE * CORNER_SIZE];
+			unsigned int stamp[CORNER_SIZE * CORNER_SIZE * CORNER_SIZE];
+			unsigned short color[CORNER_SIZE * CORNER_SIZE * CORNER_SIZE]; // Color of the vertex in index.
+			unsigned int generation;
+		};
+
+		// Returns the index of the vertex at the lattice corner (x, y, z) with the given color, adding it if it doesn't exist
+		// yet. The lookup is a direct index into the corner table, so a corner shared by voxels of different colors only
+		// keeps the most recent one and the others may be added more than once.
+		static unsigned int AddVertex(ChunkMesh& mesh, CornerTable& corners, const int x, const int y, const int z,
+			const unsigned short color);
+
+		// Emits one face quad covering the voxels from start to end (inclusive, as row, column, slice).
+		static void AddFace(ChunkMesh& mesh, CornerTable& corners, const int face, const int start[3], const int end[3],
+			const unsigned short color);
+
+		// A chunk and its neighbors' occupancy copied out of the octree so they can be meshed like stored chunks.
+		// Each meshing thread has its own.
+		struct OctreeBlock {
+			VoxelChunk chunk;
+			std::uint64_t neighbors[FACE_COUNT][VoxelChunk::WORD_COUNT];
+		};
+
+		// Regenerates the mesh for a single chunk. neighbors holds the occupancy of the chunk across each face (nullptr if
+		// empty) and is only read for MESH_CULLED and MESH_GREEDY. Only reads the voxel storage, so it is safe to call for
+		// different chunks from several threads at once.
+		void MeshChunk(ChunkMesh& mesh, CornerTable& corners, const VoxelChunk* chunk, const int base[3],
+			const std::uint64_t* const neighbors[FACE_COUNT]) const;
+
+		// Emits the exposed faces of a chunk merged into maximal same material rectangles.
+		void GreedyMeshChunk(ChunkMesh& mesh, CornerTable& corners, const VoxelChunk* chunk, const int base[3],
+			const std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) const;
+
+		VOXEL_STORAGE storage;
+		std::unordered_map<MortonKey, std::unique_ptr<VoxelChunk>, MortonKey::Hash> chunks; // STORAGE_CHUNKS only.
+		VoxelOctree octree; // STORAGE_OCTREE only.
+		// Ordered by key so the combined buffers are deterministic and neighboring chunks end up close together.
+		std::map<MortonKey, ChunkMesh> chunk_meshes;
+		std::unordered_set<MortonKey, MortonKey::Hash> dirty_chunks;
+		size_t voxel_count;
+		MESH_MODE mesh_mode;
+		MeshStats mesh_stats;
+		std::vector<PackedVertex> verts;
 		std::vector<unsigned int> indicies;
-		std::map<std::tuple<float, float, float>, unsigned int> index_list;
+		std::vector<Voxel> materials; // Distinct materials, chunks store indices into this.
+		std::vector<float> palette; // RGB of each material for the shader.
+		std::vector<std::unique_ptr<CornerTable>> corner_tables; // One per meshing thread.
+		std::vector<std::unique_ptr<OctreeBlock>> octree_blocks; // One per meshing thread, STORAGE_OCTREE only.
+		std::unique_ptr<WorkerPool> mesh_pool;
 	};
 }
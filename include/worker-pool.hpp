@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vv {
+	/* A fixed set of worker threads that run batches of indexed jobs.
+	*
+	* The calling thread takes part in every batch as worker 0, so a pool of
+	* thread_count 1 starts no threads and runs everything serially. Jobs are
+	* handed out in index order, but may finish in any order, so each job
+	* should write only to its own output slot.
+	*/
+	class WorkerPool {
+	public:
+		explicit WorkerPool(const size_t thread_count) : job(nullptr), job_count(0), next_index(0), remaining(0),
+			active(0), batch(0), stopping(false) {
+			for (size_t worker = 1; worker < thread_count; ++worker) {
+				this->threads.emplace_back(&WorkerPool::WorkerLoop, this, worker);
+			}
+		}
+
+		~WorkerPool() {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->stopping = true;
+			}
+			this->batch_started.notify_all();
+			for (auto& thread : this->threads) {
+				thread.join();
+			}
+		}
+
+		// Returns the number of workers, including the calling thread.
+		size_t GetThreadCount() const {
+			return this->threads.size() + 1;
+		}
+
+		/**
+		* \brief Runs job(index, worker) for every index in [0, count) and waits for all of them to finish.
+		*
+		* \param[in] const size_t count The number of jobs.
+		* \param[in] const std::function<void(size_t, size_t)>& job Called with the job index and the worker (in [0, GetThreadCount())) running it.
+		* \return void
+		*/
+		void ParallelFor(const size_t count, const std::function<void(size_t, size_t)>& job) {
+			if (count == 0) {
+				return;
+			}
+			if (this->threads.empty() || count == 1) {
+				for (size_t index = 0; index < count; ++index) {
+					job(index, 0);
+				}
+				return;
+			}
+
+			{
+				// Wait for workers still leaving the previous batch before its state is replaced.
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->batch_finished.wait(lock, [this] () { return this->active == 0; });
+				this->job = &job;
+				this->job_count = count;
+				this->next_index = 0;
+				this->remaining = count;
+				++this->batch;
+			}
+			this->batch_started.notify_all();
+
+			RunJobs(0);
+
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->batch_finished.wait(lock, [this] () { return this->remaining == 0; });
+		}
+	private:
+		WorkerPool(const WorkerPool&);
+		WorkerPool& operator=(const WorkerPool&);
+
+		void WorkerLoop(const size_t worker) {
+			size_t seen_batch = 0;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(this->mutex);
+					this->batch_started.wait(lock, [this, seen_batch] () { return this->stopping || this->batch != seen_batch; });
+					if (this->stopping) {
+						return;
+					}
+					seen_batch = this->batch;
+					++this->active;
+				}
+				RunJobs(worker);
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					--this->active;
+				}
+				this->batch_finished.notify_all();
+			}
+		}
+
+		// Claims and runs jobs from the current batch until none are left.
+		void RunJobs(const size_t worker) {
+			size_t finished = 0;
+			for (size_t index = this->next_index++; index < this->job_count; index = this->next_index++) {
+				(*this->job)(index, worker);
+				++finished;
+			}
+			if (finished) {
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->remaining -= finished;
+				if (this->remaining == 0) {
+					this->batch_finished.notify_all();
+				}
+			}
+		}
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable batch_started;
+		std::condition_variable batch_finished;
+		const std::function<void(size_t, size_t)>* job;
+		size_t job_count;
+		std::atomic<size_t> next_index;
+		size_t remaining;
+		size_t active; // Pool threads currently inside RunJobs().
+		size_t batch;
+		bool stopping;
+	};
+}
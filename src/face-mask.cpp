@@ -0,0 +1,189 @@
+#include "face-mask.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VV_FACE_MASK_X86
+#include <immintrin.h>
+#endif
+
+#if defined(VV_FACE_MASK_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define VV_TARGET_AVX2
+#endif
+
+namespace vv {
+	// Each occupancy word holds 4 rows of 16 columns, so a slice is 4 words.
+	static const int WORDS_PER_SLICE = VoxelChunk::SIZE * VoxelChunk::SIZE / 64;
+	static const int ROW_BITS = VoxelChunk::SIZE;
+	static const std::uint64_t FIRST_COLUMN = 0x0001000100010001ULL; // Column 0 of each row in a word.
+	static const std::uint64_t LAST_COLUMN = 0x8000800080008000ULL; // Column 15 of each row in a word.
+
+	// Stands in for the occupancy of a missing neighbor chunk.
+	static const std::uint64_t EMPTY_CHUNK[VoxelChunk::WORD_COUNT] = { 0 };
+
+	// The reference kernel, tests one voxel and one neighbor bit at a time.
+	static void ExtractExposedFacesPerVoxel(const std::uint64_t* occupancy, const std::uint64_t* const neighbors[FACE_COUNT],
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) {
+		// Neighbor offset (row, column, slice) of each FACE_DIRECTION.
+		static const int offsets[FACE_COUNT][3] = { { 0, 0, 1 }, { 1, 0, 0 }, { 0, 0, -1 }, { -1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 } };
+		for (int face = 0; face < FACE_COUNT; ++face) {
+			for (int w = 0; w < VoxelChunk::WORD_COUNT; ++w) {
+				exposed[face][w] = 0;
+			}
+		}
+		for (int index = 0; index < VoxelChunk::SIZE * VoxelChunk::SIZE * VoxelChunk::SIZE; ++index) {
+			if (!((occupancy[index >> 6] >> (index & 63)) & 1)) {
+				continue;
+			}
+			const int position[3] = { VoxelChunk::Row(index), VoxelChunk::Column(index), VoxelChunk::Slice(index) };
+			for (int face = 0; face < FACE_COUNT; ++face) {
+				int neighbor[3];
+				bool inside = true;
+				for (int axis = 0; axis < 3; ++axis) {
+					neighbor[axis] = position[axis] + offsets[face][axis];
+					inside = inside && neighbor[axis] >= 0 && neighbor[axis] < VoxelChunk::SIZE;
+				}
+				// Past the chunk's edge the coordinate wraps around into the neighbor chunk.
+				const std::uint64_t* words = inside ? occupancy : neighbors[face];
+				int neighbor_index = VoxelChunk::Index(neighbor[0] & (VoxelChunk::SIZE - 1), neighbor[1] & (VoxelChunk::SIZE - 1),
+					neighbor[2] & (VoxelChunk::SIZE - 1));
+				if (!((words[neighbor_index >> 6] >> (neighbor_index & 63)) & 1)) {
+					exposed[face][index >> 6] |= 1ULL << (index & 63);
+				}
+			}
+		}
+	}
+
+	static void ExtractExposedFacesScalar(const std::uint64_t* occupancy, const std::uint64_t* const neighbors[FACE_COUNT],
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) {
+		const int last_word = VoxelChunk::WORD_COUNT - WORDS_PER_SLICE;
+		for (int w = 0; w < VoxelChunk::WORD_COUNT; ++w) {
+			const std::uint64_t solid = occupancy[w];
+			const int row_word = w % WORDS_PER_SLICE;
+
+			// Slices are whole words apart, so the neighbor is the same word one slice over.
+			std::uint64_t front = w < last_word ? occupancy[w + WORDS_PER_SLICE] : neighbors[FACE_FRONT][w - last_word];
+			std::uint64_t back = w >= WORDS_PER_SLICE ? occupancy[w - WORDS_PER_SLICE] : neighbors[FACE_BACK][w + last_word];
+
+			// Rows are 16 bits apart, the row past the end of a word comes from the next (or previous) word.
+			std::uint64_t above = row_word < WORDS_PER_SLICE - 1 ? occupancy[w + 1] : neighbors[FACE_TOP][w - row_word];
+			std::uint64_t below = row_word > 0 ? occupancy[w - 1] : neighbors[FACE_BOTTOM][w + WORDS_PER_SLICE - 1];
+			std::uint64_t top = (solid >> ROW_BITS) | (above << (64 - ROW_BITS));
+			std::uint64_t bottom = (solid << ROW_BITS) | (below >> (64 - ROW_BITS));
+
+			// Columns are adjacent bits, the column past the end of a row comes from the neighbor chunk.
+			std::uint64_t left = ((solid << 1) & ~FIRST_COLUMN) | ((neighbors[FACE_LEFT][w] & LAST_COLUMN) >> (ROW_BITS - 1));
+			std::uint64_t right = ((solid >> 1) & ~LAST_COLUMN) | ((neighbors[FACE_RIGHT][w] & FIRST_COLUMN) << (ROW_BITS - 1));
+
+			exposed[FACE_FRONT][w] = solid & ~front;
+			exposed[FACE_TOP][w] = solid & ~top;
+			exposed[FACE_BACK][w] = solid & ~back;
+			exposed[FACE_BOTTOM][w] = solid & ~bottom;
+			exposed[FACE_LEFT][w] = solid & ~left;
+			exposed[FACE_RIGHT][w] = solid & ~right;
+		}
+	}
+
+#ifdef VV_FACE_MASK_X86
+	// Same as the scalar kernel, but handles a whole slice (4 words) per operation.
+	VV_TARGET_AVX2 static void ExtractExposedFacesAVX2(const std::uint64_t* occupancy, const std::uint64_t* const neighbors[FACE_COUNT],
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) {
+		const int last_word = VoxelChunk::WORD_COUNT - WORDS_PER_SLICE;
+		const __m256i first_column = _mm256_set1_epi64x(static_cast<long long>(FIRST_COLUMN));
+		const __m256i last_column = _mm256_set1_epi64x(static_cast<long long>(LAST_COLUMN));
+
+		for (int w = 0; w < VoxelChunk::WORD_COUNT; w += WORDS_PER_SLICE) {
+			const __m256i solid = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(occupancy + w));
+
+			const std::uint64_t* front_words = w < last_word ? occupancy + w + WORDS_PER_SLICE : neighbors[FACE_FRONT];
+			const std::uint64_t* back_words = w >= WORDS_PER_SLICE ? occupancy + w - WORDS_PER_SLICE : neighbors[FACE_BACK] + last_word;
+			__m256i front = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(front_words));
+			__m256i back = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(back_words));
+
+			// Rotate the slice's words by one and patch in the neighbor chunk's row for the word at the edge.
+			__m256i above = _mm256_blend_epi32(_mm256_permute4x64_epi64(solid, 0x39),
+				_mm256_set1_epi64x(static_cast<long long>(neighbors[FACE_TOP][w])), 0xC0);
+			__m256i below = _mm256_blend_epi32(_mm256_permute4x64_epi64(solid, 0x93),
+				_mm256_set1_epi64x(static_cast<long long>(neighbors[FACE_BOTTOM][w + WORDS_PER_SLICE - 1])), 0x03);
+			__m256i top = _mm256_or_si256(_mm256_srli_epi64(solid, ROW_BITS), _mm256_slli_epi64(above, 64 - ROW_BITS));
+			__m256i bottom = _mm256_or_si256(_mm256_slli_epi64(solid, ROW_BITS), _mm256_srli_epi64(below, 64 - ROW_BITS));
+
+			__m256i left_words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(neighbors[FACE_LEFT] + w));
+			__m256i right_words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(neighbors[FACE_RIGHT] + w));
+			__m256i left = _mm256_or_si256(_mm256_andnot_si256(first_column, _mm256_slli_epi64(solid, 1)),
+				_mm256_srli_epi64(_mm256_and_si256(left_words, last_column), ROW_BITS - 1));
+			__m256i right = _mm256_or_si256(_mm256_andnot_si256(last_column, _mm256_srli_epi64(solid, 1)),
+				_mm256_slli_epi64(_mm256_and_si256(right_words, first_column), ROW_BITS - 1));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_FRONT] + w), _mm256_andnot_si256(front, solid));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_TOP] + w), _mm256_andnot_si256(top, solid));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_BACK] + w), _mm256_andnot_si256(back, solid));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_BOTTOM] + w), _mm256_andnot_si256(bottom, solid));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_LEFT] + w), _mm256_andnot_si256(left, solid));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(exposed[FACE_RIGHT] + w), _mm256_andnot_si256(right, solid));
+		}
+	}
+
+	static bool CPUSupportsAVX2() {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		// The OS must save the YMM registers (OSXSAVE and XCR0 bits 1 and 2).
+		if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#else
+	static bool CPUSupportsAVX2() {
+		return false;
+	}
+#endif
+
+	typedef void (*FaceMaskFunction)(const std::uint64_t*, const std::uint64_t* const[FACE_COUNT],
+		std::uint64_t[FACE_COUNT][VoxelChunk::WORD_COUNT]);
+
+	static FACE_MASK_KERNEL selected_kernel = FACE_MASK_SCALAR;
+	static FaceMaskFunction face_mask_function = ExtractExposedFacesScalar;
+	// Picks the fastest kernel before main() runs so the first mesh doesn't pay for the CPU check.
+	static FACE_MASK_KERNEL initial_kernel = SetFaceMaskKernel(FACE_MASK_AUTO);
+
+	FACE_MASK_KERNEL SetFaceMaskKernel(const FACE_MASK_KERNEL kernel) {
+		if (kernel == FACE_MASK_PER_VOXEL) {
+			selected_kernel = FACE_MASK_PER_VOXEL;
+			face_mask_function = ExtractExposedFacesPerVoxel;
+			return selected_kernel;
+		}
+		selected_kernel = FACE_MASK_SCALAR;
+		face_mask_function = ExtractExposedFacesScalar;
+#ifdef VV_FACE_MASK_X86
+		if (kernel != FACE_MASK_SCALAR && CPUSupportsAVX2()) {
+			selected_kernel = FACE_MASK_AVX2;
+			face_mask_function = ExtractExposedFacesAVX2;
+		}
+#endif
+		return selected_kernel;
+	}
+
+	FACE_MASK_KERNEL GetFaceMaskKernel() {
+		return selected_kernel;
+	}
+
+	void ExtractExposedFaces(const std::uint64_t* occupancy, const std::uint64_t* const neighbors[FACE_COUNT],
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) {
+		const std::uint64_t* borders[FACE_COUNT];
+		for (int face = 0; face < FACE_COUNT; ++face) {
+			borders[face] = neighbors[face] ? neighbors[face] : EMPTY_CHUNK;
+		}
+		face_mask_function(occupancy, borders, exposed);
+	}
+}
@@ -4,7 +4,7 @@
 #include "vertexbuffer.hpp"
 #include "shader.hpp"
 #include "multiton.hpp"
-#include "voxelvolume.hpp"
+#include "voxel-volume-manager.hpp"
 #include "transform.hpp"
 #include "material.hpp"
 #include <glm/gtc/matrix_transform.hpp>
@@ -34,7 +34,6 @@ struct CameraMover : public vv::Subscriber < vv::KeyboardEvent > {
 		vv::RenderSystem::QueueCommand(vv::VIEW_ACTIVATE, 1);
 		break;
 		}
-		vv::RenderSystem::QueueCommand(vv::MODEL_MATRIX_UPDATE, 1);
 		break;
 		default:
 		break;
@@ -50,11 +49,14 @@ int main(int argc, void* argv) {
 	vv::RenderSystem rs;
 
 	rs.SetViewportSize(800, 600);
+	rs.SetCommandCoalescing(true);
 
-	vv::VoxelVolume voxvol;
+	vv::VoxelVolumeManager voxel_volumes;
+	vv::VoxelVolume* voxvol = voxel_volumes.AddVolume(100);
+	voxvol->SetCommandCoalescing(true);
 
 	auto s = std::make_shared<vv::Shader>();
-	s->LoadFromFile(vv::Shader::VERTEX, "basic.vert");
+	s->LoadFromFile(vv::Shader::VERTEX, "voxel-instanced.vert");
 	s->LoadFromFile(vv::Shader::FRAGMENT, "basic.frag");
 	s->Build();
 	vv::ShaderMap::Set("shader1", s);
@@ -63,7 +65,7 @@ int main(int argc, void* argv) {
 	vv::MaterialMap::Set("material_basic", basic_fill);
 
 	auto s_overlay = std::make_shared<vv::Shader>();
-	s_overlay->LoadFromFile(vv::Shader::VERTEX, "basic.vert");
+	s_overlay->LoadFromFile(vv::Shader::VERTEX, "voxel-instanced.vert");
 	s_overlay->LoadFromFile(vv::Shader::FRAGMENT, "overlay.frag");
 	s_overlay->Build();
 	vv::ShaderMap::Set("shader_overlay", s_overlay);
@@ -72,7 +74,7 @@ int main(int argc, void* argv) {
 	overlay->SetFillMode(GL_LINE);
 	vv::MaterialMap::Set("material_overlay", overlay);
 
-	auto voxvol_transform = std::make_shared<vv::Transform>();
+	auto voxvol_transform = std::make_shared<vv::Transform>(100);
 	vv::TransformMap::Set(100, voxvol_transform);
 	auto vb = std::make_shared<vv::VertexBuffer>();
 	vv::VertexBufferMap::Set(100, vb);
@@ -83,27 +85,31 @@ int main(int argc, void* argv) {
 	vv::VoxelVolume::QueueCommand<vv::VoxelCommand, std::tuple<short, short, short>>(vv::VOXEL_ADD, 100, std::tuple<short, short, short>(0, -1, -1));
 	vv::VoxelVolume::QueueCommand<vv::VoxelCommand, std::tuple<short, short, short>>(vv::VOXEL_ADD, 100, std::tuple<short, short, short>(1, -1, 1));
 
-	voxvol.Update(0.0);
-	vb->Buffer(voxvol.GetVertexBuffer(), voxvol.GetIndexBuffer());
+	voxel_volumes.Update(0.0);
+	vb->Buffer(voxvol->GetVertexBuffer(), voxvol->GetIndexBuffer());
+	vb->SetPalette(voxvol->GetPalette());
 	rs.AddVertexBuffer(basic_fill, vb, 100);
 	rs.AddVertexBuffer(overlay, vb, 100);
 
 	auto vb2 = std::make_shared<vv::VertexBuffer>();
 	vv::VertexBufferMap::Set(1, vb2);
-	vb2->Buffer(voxvol.GetVertexBuffer(), voxvol.GetIndexBuffer());
+	vb2->Buffer(voxvol->GetVertexBuffer(), voxvol->GetIndexBuffer());
+	vb2->SetPalette(voxvol->GetPalette());
 	rs.AddVertexBuffer(basic_fill, vb2, 1);
 
-	auto camera_transform = std::make_shared<vv::Transform>();
+	// Transforms made with an entity ID start dirty, so the render system picks up their model matrices on its own.
+	auto camera_transform = std::make_shared<vv::Transform>(1);
 	vv::TransformMap::Set(1, camera_transform);
 	vv::RenderSystem::QueueCommand(vv::VIEW_ACTIVATE, 1);
-	vv::RenderSystem::QueueCommand(vv::MODEL_MATRIX_ADD, 1);
 
-	auto camera_transform2 = std::make_shared<vv::Transform>();
+	auto camera_transform2 = std::make_shared<vv::Transform>(2);
 	vv::TransformMap::Set(2, camera_transform2);
-	vv::RenderSystem::QueueCommand(vv::MODEL_MATRIX_ADD, 2);
 
 	CameraMover cam_mover;
 
+	// Mouse moves can arrive many times a frame, deliver them once per OSMessageLoop().
+	vv::Dispatcher<vv::MouseMoveEvent>::GetInstance()->SetDeferred(true);
+
 	while (!os.Closing()) {
 		rs.Update(os.GetDeltaTime());
 		os.OSMessageLoop();
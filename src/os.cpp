@@ -116,6 +116,10 @@ namespace vv {
 
 	void OS::OSMessageLoop() {
 		glfwPollEvents();
+		// Input dispatchers in deferred mode buffered the callbacks' events, deliver them all now.
+		Dispatcher<KeyboardEvent>::GetInstance()->DeliverEvents();
+		Dispatcher<MouseMoveEvent>::GetInstance()->DeliverEvents();
+		Dispatcher<MouseBtnEvent>::GetInstance()->DeliverEvents();
 	}
 
 	int OS::GetWindowWidth() {
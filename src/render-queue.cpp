@@ -0,0 +1,68 @@
+#include "render-queue.hpp"
+#include <utility>
+
+namespace vv {
+	const unsigned int RenderQueue::SHADER_BITS;
+	const unsigned int RenderQueue::MATERIAL_BITS;
+	const unsigned int RenderQueue::BUFFER_BITS;
+	const unsigned int RenderQueue::DEPTH_BITS;
+
+	std::uint64_t RenderQueue::MakeSortKey(const std::uint32_t shader, const std::uint32_t material,
+		const std::uint32_t buffer, const std::uint32_t depth) {
+		std::uint64_t key = shader & ((1u << SHADER_BITS) - 1);
+		key = (key << MATERIAL_BITS) | (material & ((1u << MATERIAL_BITS) - 1));
+		key = (key << BUFFER_BITS) | (buffer & ((1u << BUFFER_BITS) - 1));
+		key = (key << DEPTH_BITS) | (depth & ((1u << DEPTH_BITS) - 1));
+		return key;
+	}
+
+	std::uint32_t RenderQueue::QuantizeDepth(const float distance, const float near_plane, const float far_plane) {
+		const std::uint32_t max_depth = (1u << DEPTH_BITS) - 1;
+		if (!(distance > near_plane)) {
+			return 0; // Also catches NaN.
+		}
+		if (distance >= far_plane) {
+			return max_depth;
+		}
+		return static_cast<std::uint32_t>((distance - near_plane) / (far_plane - near_plane) * max_depth);
+	}
+
+	void RenderQueue::Sort() {
+		const size_t count = this->entries.size();
+		if (count < 2) {
+			return;
+		}
+
+		// One histogram per digit, all counted in a single read of the keys.
+		size_t histograms[8][256] = {};
+		for (const Entry& entry : this->entries) {
+			for (int digit = 0; digit < 8; ++digit) {
+				++histograms[digit][(entry.key >> (digit * 8)) & 0xFF];
+			}
+		}
+
+		this->scratch.resize(count);
+		Entry* source = &this->entries[0];
+		Entry* destination = &this->scratch[0];
+		for (int digit = 0; digit < 8; ++digit) {
+			size_t* histogram = histograms[digit];
+			// Every key has the same digit, this pass wouldn't move anything.
+			if (histogram[(source[0].key >> (digit * 8)) & 0xFF] == count) {
+				continue;
+			}
+			size_t offset = 0;
+			for (int bucket = 0; bucket < 256; ++bucket) {
+				const size_t bucket_count = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucket_count;
+			}
+			for (size_t index = 0; index < count; ++index) {
+				destination[histogram[(source[index].key >> (digit * 8)) & 0xFF]++] = source[index];
+			}
+			std::swap(source, destination);
+		}
+		if (source != &this->entries[0]) {
+			this->entries.swap(this->scratch);
+		}
+	}
+}
@@ -1,5 +1,6 @@
 #include "render-system.hpp"
 #include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
 #include <iostream>
 #include <thread>
 
@@ -14,9 +15,37 @@ namespace vv {
 		GLuint name;
 	};
 
-	typedef Multiton<std::string, std::shared_ptr<Texture>> TextureMap;
+	typedef DenseMultiton<std::string, std::shared_ptr<Texture>> TextureMap;
 
-	std::atomic<std::queue<std::shared_ptr<Command<RS_COMMAND>>>*> RenderSystem::global_queue = new std::queue<std::shared_ptr<Command<RS_COMMAND>>>();
+	static const float NEAR_PLANE = 0.1f;
+	static const float FAR_PLANE = 10000.0f;
+
+	const std::uint32_t RenderSystem::NO_SHADER;
+	const std::uint32_t RenderSystem::DROPPED;
+
+	// Removes the entries whose locked pointer is null from entries and locked, keeping the rest in order. remap is set
+	// to each old index's new one, or dropped, and indices is updated to match. owner returns an entry's key in indices.
+	template <typename Entry, typename Locked, typename Indices, typename Owner>
+	static void DropExpired(std::vector<Entry>& entries, std::vector<Locked>& locked, Indices& indices,
+		std::vector<std::uint32_t>& remap, const std::uint32_t dropped, Owner owner) {
+		remap.resize(entries.size());
+		std::uint32_t kept = 0;
+		for (std::uint32_t index = 0; index < entries.size(); ++index) {
+			if (!locked[index]) {
+				indices.erase(owner(entries[index]));
+				remap[index] = dropped;
+				continue;
+			}
+			if (kept != index) {
+				entries[kept] = std::move(entries[index]);
+				locked[kept] = std::move(locked[index]);
+				indices[owner(entries[kept])] = kept;
+			}
+			remap[index] = kept++;
+		}
+		entries.resize(kept);
+		locked.resize(kept);
+	}
 
 	RenderSystem::RenderSystem() : current_view(0) {
 		auto err = glGetError();
@@ -54,29 +83,69 @@ namespace vv {
 		this->projection = glm::perspective(
 			glm::radians(45.0f),
 			aspect_ratio,
-			0.1f,
-			10000.0f
+			NEAR_PLANE,
+			FAR_PLANE
 			);
 	}
 
 	void RenderSystem::ProcessCommandQueue() {
-		auto queue = global_queue.exchange(this->local_queue);
+		this->pending_commands.clear();
+		global_queue.Peek([this] (Command<RS_COMMAND>* action) {
+			this->pending_commands.push_back(action);
+		});
 
-		while (!queue->empty()) {
-			auto action = queue->front();
-			queue->pop();
+		this->coalescer.Begin();
+		if (this->coalesce_commands) {
+			for (size_t index = 0; index < this->pending_commands.size(); ++index) {
+				Command<RS_COMMAND>* action = this->pending_commands[index];
+				switch (action->command) {
+				// These recompute the matrix from the entity's current transform, so back to back repeats for an entity
+				// only need to run once.
+				case RS_COMMAND::VIEW_ADD:
+				case RS_COMMAND::VIEW_UPDATE:
+				case RS_COMMAND::MODEL_MATRIX_ADD:
+				case RS_COMMAND::MODEL_MATRIX_UPDATE:
+				this->coalescer.Add(static_cast<std::uint64_t>(action->entity_id), action->command, index);
+				break;
+				default:
+				this->coalescer.AddBarrier(static_cast<std::uint64_t>(action->entity_id), index);
+				break;
+				}
+			}
+			this->dropped_commands += this->coalescer.Resolve();
+		}
 
+		// Camera changes are what the user notices first, so they never wait on the budget. They only touch the views,
+		// so running them ahead of queued model matrix and buffer commands doesn't change the result.
+		auto is_urgent = [] (Command<RS_COMMAND>* action) {
+			switch (action->command) {
+			case RS_COMMAND::VIEW_ACTIVATE:
+			case RS_COMMAND::VIEW_ADD:
+			case RS_COMMAND::VIEW_UPDATE:
+			case RS_COMMAND::VIEW_REMOVE:
+			return true;
+			default:
+			return false;
+			}
+		};
+		RunCommands(this->pending_commands, is_urgent, [this] (Command<RS_COMMAND>* action) {
 			switch (action->command) {
 			case RS_COMMAND::VIEW_ACTIVATE:
 			this->current_view = action->entity_id;
 			case RS_COMMAND::VIEW_ADD:
 			case RS_COMMAND::VIEW_UPDATE:
-			UpdateViewMatrix(action->entity_id);
+			this->stale_views.insert(action->entity_id);
 			break;
 			case RS_COMMAND::VIEW_REMOVE:
 			this->views.erase(action->entity_id);
+			this->stale_views.erase(action->entity_id);
 			break;
 			case RS_COMMAND::MODEL_MATRIX_ADD:
+			// The entity's transform may not be in the TransformMap yet, keep asking for it until it is.
+			if (!UpdateModelMatrix(action->entity_id)) {
+				this->unresolved_transforms.insert(action->entity_id);
+			}
+			break;
 			case RS_COMMAND::MODEL_MATRIX_UPDATE:
 			UpdateModelMatrix(action->entity_id);
 			break;
@@ -90,11 +159,51 @@ namespace vv {
 			}*/
 			break;
 			}
+		});
+		// Reclaims the space of the commands that ran, any deferred ones stay queued for the next frame.
+		global_queue.Drain([] (Command<RS_COMMAND>*) { }, 0);
+	}
+
+	void RenderSystem::UpdateModelMatrices() {
+		Transform::TakeDirtyList(this->dirty_transforms);
+		for (GUID entity_id : this->dirty_transforms) {
+			if (UpdateModelMatrix(entity_id)) {
+				this->unresolved_transforms.erase(entity_id);
+			}
+			// Only worth retrying for an entity that already has a model matrix, anything else is added by a
+			// MODEL_MATRIX_ADD.
+			else if (this->transforms.Contains(entity_id)) {
+				this->unresolved_transforms.insert(entity_id);
+			}
+		}
+		for (auto entity_id = this->unresolved_transforms.begin(); entity_id != this->unresolved_transforms.end();) {
+			if (UpdateModelMatrix(*entity_id)) {
+				entity_id = this->unresolved_transforms.erase(entity_id);
+			}
+			else {
+				++entity_id;
+			}
 		}
+		this->model_matrix_stats.transforms_changed = this->dirty_transforms.size();
+		this->model_matrix_stats.matrices_rebuilt = this->transforms.UpdateModelMatrices();
+		this->model_matrix_stats.world_matrices_rebuilt = this->transforms.GetWorldMatrixUpdateCount();
+
+		// A view may be attached to something that moved, there are few enough views to recompute them all.
+		if (this->model_matrix_stats.world_matrices_rebuilt > 0) {
+			for (auto& view : this->views) {
+				this->stale_views.insert(view.first);
+			}
+		}
+
+		for (GUID entity_id : this->stale_views) {
+			UpdateViewMatrix(entity_id);
+		}
+		this->stale_views.clear();
 	}
 
 	void RenderSystem::Update(const double delta) {
 		ProcessCommandQueue();
+		UpdateModelMatrices();
 		static float red = 0.3f, blue = 0.3f, green = 0.3f;
 
 		glClearColor(red, green, blue, 1.0f);
@@ -103,110 +212,231 @@ namespace vv {
 
 		auto camera_matrix = this->views[this->current_view];
 
-		for (auto material_group : this->buffers) {
-			auto material = material_group.first.lock();
-			if (!material) {
-				continue;
+		BuildRenderQueue(camera_matrix);
+		SubmitRenderQueue(camera_matrix);
+
+		this->frame_shaders.clear();
+		this->frame_materials.clear();
+		this->frame_material_shaders.clear();
+		this->frame_buffers.clear();
+	}
+
+	void RenderSystem::BuildRenderQueue(const glm::mat4& camera_matrix) {
+		// Each material, shader and buffer is locked once per frame rather than once per draw. A material's shader is
+		// looked up each frame rather than cached when it is added. Shaders are locked last, as the lookup may add some.
+		for (auto& material : this->materials) {
+			std::shared_ptr<Material> locked = material.lock();
+			std::shared_ptr<Shader> shader = locked ? locked->GetShader().lock() : nullptr;
+			this->frame_material_shaders.push_back(shader ? FindShader(shader) : NO_SHADER);
+			this->frame_materials.push_back(std::move(locked));
+		}
+		for (auto& binding : this->shaders) {
+			this->frame_shaders.push_back(binding.shader.lock());
+		}
+		for (auto& buffer : this->buffers) {
+			this->frame_buffers.push_back(buffer.lock());
+		}
+
+		// An expired weak_ptr never comes back, so expired shaders, materials and buffers are dropped along with the
+		// items that use them.
+		DropExpired(this->shaders, this->frame_shaders, this->shader_indices, this->shader_remap, DROPPED,
+			[] (const ShaderBinding& binding) -> const std::weak_ptr<Shader>& { return binding.shader; });
+		DropExpired(this->materials, this->frame_materials, this->material_indices, this->material_remap, DROPPED,
+			[] (const std::weak_ptr<Material>& material) -> const std::weak_ptr<Material>& { return material; });
+		DropExpired(this->buffers, this->frame_buffers, this->buffer_indices, this->buffer_remap, DROPPED,
+			[] (const std::weak_ptr<VertexBuffer>& buffer) -> const std::weak_ptr<VertexBuffer>& { return buffer; });
+		// Materials only move down, so their shaders can be moved in place.
+		for (size_t material = 0; material < this->material_remap.size(); ++material) {
+			const std::uint32_t moved_to = this->material_remap[material];
+			if (moved_to != DROPPED) {
+				const std::uint32_t shader = this->frame_material_shaders[material];
+				this->frame_material_shaders[moved_to] = shader == NO_SHADER ? NO_SHADER : this->shader_remap[shader];
 			}
-			glPolygonMode(GL_FRONT_AND_BACK, material->GetFillMode());
-			auto shader = material->GetShader().lock();
-			if (!material) {
-				continue;
+		}
+		this->frame_material_shaders.resize(this->materials.size());
+
+		size_t kept = 0;
+		for (const RenderItem& item : this->render_items) {
+			RenderItem moved = item;
+			moved.material = this->material_remap[item.material];
+			moved.buffer = this->buffer_remap[item.buffer];
+			if (moved.material != DROPPED && moved.buffer != DROPPED &&
+				this->frame_material_shaders[moved.material] != NO_SHADER) {
+				this->render_items[kept++] = moved;
 			}
-			shader->Use();
+		}
+		this->render_items.resize(kept);
 
-			glUniformMatrix4fv(shader->GetUniform("view"), 1, GL_FALSE, &camera_matrix[0][0]);
-			glUniformMatrix4fv(shader->GetUniform("projection"), 1, GL_FALSE, &this->projection[0][0]);
-			GLint model_index = shader->GetUniform("model");
+		auto start = std::chrono::high_resolution_clock::now();
+		this->render_queue.Clear();
+		for (size_t index = 0; index < this->render_items.size(); ++index) {
+			const RenderItem& item = this->render_items[index];
+			const std::uint32_t shader = this->frame_material_shaders[item.material];
 
-			auto vb = material_group.second.first.lock();
-			if (!vb) {
-				continue;
+			// Front to back within each group, so the depth test rejects hidden fragments early.
+			float distance = NEAR_PLANE;
+			const glm::mat4* model_matrix = this->transforms.GetModelMatrix(item.entity_id);
+			if (model_matrix) {
+				distance = -(camera_matrix * (*model_matrix)[3]).z;
 			}
-			glBindVertexArray(vb->vao);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ibo);
-			/*for (size_t i = 0; i < mesh_group.second.textures.size(); ++i) {
-				auto tex = mesh_group.second.textures[i].lock();
-				GLuint name = 0;
-				if (tex) {
-				name = tex->name;
-				}
-				shader->ActivateTextureUnit(i, name);
-				}*/
-
-			for (GUID entity_id : material_group.second.second) {
-				auto transform = ModelMatrixMap::Get(entity_id);
-				if (transform) {
-					glUniformMatrix4fv(model_index, 1, GL_FALSE,
-						&transform->transform[0][0]);
-				}
-				else {
-					static glm::mat4 identity(1.0);
-					glUniformMatrix4fv(model_index, 1, GL_FALSE,
-						&identity[0][0]);
-				}
-				/*auto renanim = ren_group.animations.find(entity_id);
-				if (renanim != ren_group.animations.end()) {
-				glUniform1i(u_animate_loc, 1);
-				auto &animmatricies = renanim->second->matrices;
-				glUniformMatrix4fv(u_animatrix_loc, animmatricies.size(), GL_FALSE, &animmatricies[0][0][0]);
+			this->render_queue.Push(RenderQueue::MakeSortKey(shader, item.material, item.buffer,
+				RenderQueue::QuantizeDepth(distance, NEAR_PLANE, FAR_PLANE)), static_cast<std::uint32_t>(index));
+		}
+		this->render_queue.Sort();
+		this->render_queue_stats.build_time_us =
+			std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void RenderSystem::SubmitRenderQueue(const glm::mat4& camera_matrix) {
+		static const std::uint32_t NONE = 0xFFFFFFFF;
+		static const glm::mat4 identity(1.0);
+		RenderQueueStats& stats = this->render_queue_stats;
+		stats.draws_queued = this->render_queue.GetCount();
+		stats.draw_calls = stats.shader_changes = stats.material_changes = stats.vao_changes = 0;
+
+		std::uint32_t current_shader = NONE, current_material = NONE, current_buffer = NONE;
+		const size_t count = this->render_queue.GetCount();
+		for (size_t entry = 0; entry < count; ) {
+			const RenderItem& item = this->render_items[this->render_queue[entry].item];
+			const std::uint32_t shader_index = this->frame_material_shaders[item.material];
+			const ShaderBinding& binding = this->shaders[shader_index];
+			Shader* shader = this->frame_shaders[shader_index].get();
+			VertexBuffer* vb = this->frame_buffers[item.buffer].get();
+
+			// The real IDs are compared rather than the key fields, which can alias.
+			const bool shader_changed = shader_index != current_shader;
+			if (shader_changed) {
+				shader->Use();
+				glUniformMatrix4fv(binding.view, 1, GL_FALSE, &camera_matrix[0][0]);
+				glUniformMatrix4fv(binding.projection, 1, GL_FALSE, &this->projection[0][0]);
+				current_shader = shader_index;
+				++stats.shader_changes;
+			}
+			if (item.material != current_material) {
+				glPolygonMode(GL_FRONT_AND_BACK, this->frame_materials[item.material]->GetFillMode());
+				current_material = item.material;
+				++stats.material_changes;
+			}
+			const bool buffer_changed = item.buffer != current_buffer;
+			if (buffer_changed) {
+				glBindVertexArray(vb->vao);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vb->ibo);
+				current_buffer = item.buffer;
+				++stats.vao_changes;
+			}
+			// The palette is per buffer but lives in the shader's uniforms, so either changing means uploading it.
+			if ((shader_changed || buffer_changed) && !vb->palette.empty()) {
+				glUniform3fv(binding.palette, static_cast<GLsizei>(vb->palette.size() / 3), &vb->palette[0]);
+			}
+
+			if (binding.instance_attribute >= 0) {
+				// Everything up to the next state change is one instanced draw.
+				this->instance_matrices.clear();
+				for (; entry < count; ++entry) {
+					const RenderItem& instance = this->render_items[this->render_queue[entry].item];
+					if (instance.material != item.material || instance.buffer != item.buffer) {
+						break;
+					}
+					const glm::mat4* model_matrix = this->transforms.GetModelMatrix(instance.entity_id);
+					this->instance_matrices.push_back(model_matrix ? *model_matrix : identity);
 				}
-				else {
-				glUniform1i(u_animate_loc, 0);
-				}*/
-				glDrawElements(GL_TRIANGLES, vb->index_count, GL_UNSIGNED_INT, 0);
+				vb->BufferInstances(static_cast<GLuint>(binding.instance_attribute), &this->instance_matrices[0][0][0],
+					this->instance_matrices.size());
+				glDrawElementsInstanced(GL_TRIANGLES, vb->index_count, vb->index_type, 0,
+					static_cast<GLsizei>(this->instance_matrices.size()));
 			}
+			else {
+				const glm::mat4* model_matrix = this->transforms.GetModelMatrix(item.entity_id);
+				glUniformMatrix4fv(binding.model, 1, GL_FALSE, model_matrix ? &(*model_matrix)[0][0] : &identity[0][0]);
+				glDrawElements(GL_TRIANGLES, vb->index_count, vb->index_type, 0);
+				++entry;
+			}
+			++stats.draw_calls;
+		}
 
-			shader->UnUse();
+		if (current_shader != NONE) {
+			this->frame_shaders[current_shader]->UnUse();
 		}
 	}
 
 	void RenderSystem::AddVertexBuffer(const std::weak_ptr<Material> mat, const std::weak_ptr<VertexBuffer> buffer, const GUID entity_id) {
-		auto mat1 = mat.lock();
-		for (auto material_group : this->buffers) {
-			auto mat2 = material_group.first.lock();
-			if ((mat1 && mat2) && (mat1 == mat2)) {
-				auto vb1 = buffer.lock();
-				auto vb2 = material_group.second.first.lock();
-				if ((vb1 && vb2) && (vb1 == vb2)) {
-					material_group.second.second.push_back(entity_id);
-					return;
-				}
-			}
+		if (mat.expired()) {
+			return;
 		}
-		std::list<GUID> entity_list;
-		entity_list.push_back(entity_id);
-		this->buffers[mat] = std::make_pair(buffer, std::move(entity_list));
+
+		RenderItem item;
+		auto material = this->material_indices.find(mat);
+		if (material == this->material_indices.end()) {
+			material = this->material_indices.insert(std::make_pair(mat,
+				static_cast<std::uint32_t>(this->materials.size()))).first;
+			this->materials.push_back(mat);
+		}
+		item.material = material->second;
+		auto buffer_index = this->buffer_indices.find(buffer);
+		if (buffer_index == this->buffer_indices.end()) {
+			buffer_index = this->buffer_indices.insert(std::make_pair(buffer,
+				static_cast<std::uint32_t>(this->buffers.size()))).first;
+			this->buffers.push_back(buffer);
+		}
+		item.buffer = buffer_index->second;
+		item.entity_id = entity_id;
+		this->render_items.push_back(item);
 	}
 
-	void RenderSystem::UpdateModelMatrix(const GUID entity_id) {
-		auto model_matrix = ModelMatrixMap::Get(entity_id);
-		auto transform = TransformMap::Get(entity_id);
-		if (!model_matrix && transform) {
-			model_matrix = std::make_shared<ModelMatrix>();
-			ModelMatrixMap::Set(entity_id, model_matrix);
+	std::uint32_t RenderSystem::FindShader(const std::shared_ptr<Shader>& shader) {
+		auto found = this->shader_indices.find(shader);
+		if (found != this->shader_indices.end()) {
+			return found->second;
 		}
-		else if (!transform) {
-			return;
+		const std::uint32_t shader_index = static_cast<std::uint32_t>(this->shaders.size());
+		this->shader_indices[shader] = shader_index;
+		ShaderBinding binding;
+		binding.shader = shader;
+		binding.view = shader->GetUniform("view");
+		binding.projection = shader->GetUniform("projection");
+		binding.model = shader->GetUniform("model");
+		binding.palette = shader->GetUniform("palette");
+		binding.instance_attribute = shader->GetAttribute("in_Model");
+		this->shaders.push_back(binding);
+		return shader_index;
+	}
+
+	bool RenderSystem::UpdateModelMatrix(const GUID entity_id) {
+		auto transform = TransformMap::Get(entity_id);
+		if (!transform) {
+			return false;
 		}
 
-		auto camera_translation = transform->GetTranslation();
-		auto camera_orientation = transform->GetOrientation();
-		model_matrix->transform = glm::translate(glm::mat4(1.0), camera_translation) * glm::mat4_cast(camera_orientation);
+		// Cleared before reading, so a change made while we read marks the transform again for next frame. The matrix
+		// itself is rebuilt with the rest of the frame's changes in UpdateModelMatrices().
+		transform->ClearDirty();
+		this->transforms.Set(entity_id, transform->GetTranslation(), transform->GetOrientation(), transform->GetScale());
+		this->transforms.SetParent(entity_id, transform->GetParent());
 		if (this->views.find(entity_id) != this->views.end()) {
-			UpdateViewMatrix(entity_id);
+			this->stale_views.insert(entity_id);
+		}
+		return true;
+	}
+
+	bool RenderSystem::GetModelMatrix(const GUID entity_id, ModelMatrix& matrix) const {
+		const glm::mat4* model_matrix = this->transforms.GetModelMatrix(entity_id);
+		if (!model_matrix) {
+			return false;
 		}
+		matrix.transform = *model_matrix;
+		return true;
 	}
 
 	void RenderSystem::RemoveModelMatrix(const GUID entity_id) {
-		ModelMatrixMap::Remove(entity_id);
+		this->transforms.Remove(entity_id);
+		this->unresolved_transforms.erase(entity_id);
 	}
 
 	void RenderSystem::UpdateViewMatrix(const GUID entity_id) {
-		auto model_matrix = ModelMatrixMap::Get(entity_id);
+		const glm::mat4* model_matrix = this->transforms.GetModelMatrix(entity_id);
 		if (!model_matrix) {
 			return;
 		}
-		this->views[entity_id] = glm::inverse(model_matrix->transform);
+		this->views[entity_id] = glm::inverse(*model_matrix);
 	}
 }
@@ -0,0 +1,510 @@
+#include "transform-store.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VV_TRANSFORM_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vv {
+	const size_t TransformStore::BLOCK_SIZE;
+	const std::uint32_t TransformStore::NO_INDEX;
+
+	// The component arrays for a run of lanes, and where their matrices go.
+	struct MatrixBlock {
+		const float* component[10];
+		float* out; // 16 floats per lane.
+	};
+
+	// Builds translation * rotation * scale for lane, see glm::translate() and glm::mat4_cast().
+	static void BuildMatrixScalar(const MatrixBlock& block, const size_t lane) {
+		const float tx = block.component[0][lane], ty = block.component[1][lane], tz = block.component[2][lane];
+		const float x = block.component[3][lane], y = block.component[4][lane], z = block.component[5][lane];
+		const float w = block.component[6][lane];
+		const float sx = block.component[7][lane], sy = block.component[8][lane], sz = block.component[9][lane];
+		float* m = block.out + lane * 16;
+
+		m[0] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+		m[1] = 2.0f * (x * y + w * z) * sx;
+		m[2] = 2.0f * (x * z - w * y) * sx;
+		m[3] = 0.0f;
+		m[4] = 2.0f * (x * y - w * z) * sy;
+		m[5] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+		m[6] = 2.0f * (y * z + w * x) * sy;
+		m[7] = 0.0f;
+		m[8] = 2.0f * (x * z + w * y) * sz;
+		m[9] = 2.0f * (y * z - w * x) * sz;
+		m[10] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+		m[11] = 0.0f;
+		m[12] = tx;
+		m[13] = ty;
+		m[14] = tz;
+		m[15] = 1.0f;
+	}
+
+	static void BuildBlockScalar(const MatrixBlock& block) {
+		for (size_t lane = 0; lane < TransformStore::BLOCK_SIZE; ++lane) {
+			BuildMatrixScalar(block, lane);
+		}
+	}
+
+#ifdef VV_TRANSFORM_SSE
+	// Same as BuildMatrixScalar() for all 4 lanes at once. Each register holds one matrix element of the 4 lanes, so
+	// every 4 columns are transposed into one column of each lane's matrix before storing.
+	static void BuildBlockSSE(const MatrixBlock& block) {
+		const __m128 x = _mm_loadu_ps(block.component[3]), y = _mm_loadu_ps(block.component[4]);
+		const __m128 z = _mm_loadu_ps(block.component[5]), w = _mm_loadu_ps(block.component[6]);
+		const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+
+		const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		__m128 columns[4][4];
+		const __m128 sx = _mm_loadu_ps(block.component[7]);
+		columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		columns[0][3] = zero;
+		const __m128 sy = _mm_loadu_ps(block.component[8]);
+		columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		columns[1][3] = zero;
+		const __m128 sz = _mm_loadu_ps(block.component[9]);
+		columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+		columns[2][3] = zero;
+		columns[3][0] = _mm_loadu_ps(block.component[0]);
+		columns[3][1] = _mm_loadu_ps(block.component[1]);
+		columns[3][2] = _mm_loadu_ps(block.component[2]);
+		columns[3][3] = one;
+
+		for (int column = 0; column < 4; ++column) {
+			__m128 r0 = columns[column][0], r1 = columns[column][1], r2 = columns[column][2], r3 = columns[column][3];
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(block.out + 0 * 16 + column * 4, r0);
+			_mm_storeu_ps(block.out + 1 * 16 + column * 4, r1);
+			_mm_storeu_ps(block.out + 2 * 16 + column * 4, r2);
+			_mm_storeu_ps(block.out + 3 * 16 + column * 4, r3);
+		}
+	}
+#endif
+
+	TransformStore::TransformStore() : hierarchy_changed(false), dead_nodes(0), world_matrix_updates(0) {
+		SetKernel(MATRIX_KERNEL_AUTO);
+	}
+
+	MATRIX_KERNEL TransformStore::SetKernel(const MATRIX_KERNEL kernel) {
+		this->kernel = MATRIX_KERNEL_SCALAR;
+#ifdef VV_TRANSFORM_SSE
+		if (kernel != MATRIX_KERNEL_SCALAR) {
+			this->kernel = MATRIX_KERNEL_SSE;
+		}
+#endif
+		return this->kernel;
+	}
+
+	void TransformStore::Reset(const size_t index) {
+		for (int component = 0; component < COMPONENT_COUNT; ++component) {
+			this->components[component][index] = 0.0f;
+		}
+		this->components[ORIENTATION_W][index] = 1.0f;
+		this->components[SCALE_X][index] = 1.0f;
+		this->components[SCALE_Y][index] = 1.0f;
+		this->components[SCALE_Z][index] = 1.0f;
+	}
+
+	void TransformStore::MarkDirty(const size_t index) {
+		const size_t block = index / BLOCK_SIZE;
+		if (!this->block_dirty[block]) {
+			this->block_dirty[block] = true;
+			this->dirty_blocks.push_back(static_cast<std::uint32_t>(block));
+		}
+	}
+
+	void TransformStore::Set(const GUID entity_id, const glm::vec3& translation, const glm::quat& orientation,
+		const glm::vec3& scale) {
+		auto found = this->indices.find(entity_id);
+		size_t index;
+		if (found != this->indices.end()) {
+			index = found->second;
+		}
+		else {
+			index = this->entity_ids.size();
+			this->indices[entity_id] = static_cast<std::uint32_t>(index);
+			this->entity_ids.push_back(entity_id);
+			if (index % BLOCK_SIZE == 0) {
+				// Start a new block, its unused lanes hold the identity.
+				for (int component = 0; component < COMPONENT_COUNT; ++component) {
+					this->components[component].resize(index + BLOCK_SIZE);
+				}
+				for (size_t lane = index; lane < index + BLOCK_SIZE; ++lane) {
+					Reset(lane);
+				}
+				this->model_matrices.resize(index + BLOCK_SIZE, glm::mat4(1.0f));
+				this->lane_changed.resize(index + BLOCK_SIZE, 0);
+				this->lane_nodes.resize(index + BLOCK_SIZE, NO_INDEX);
+				this->block_dirty.push_back(false);
+			}
+			// The entity may already be linked to from a hierarchy.
+			auto node = this->hierarchy_indices.find(entity_id);
+			if (node != this->hierarchy_indices.end()) {
+				this->hierarchy[node->second].lane = static_cast<std::uint32_t>(index);
+				this->lane_nodes[index] = node->second;
+			}
+		}
+
+		this->components[TRANSLATION_X][index] = translation.x;
+		this->components[TRANSLATION_Y][index] = translation.y;
+		this->components[TRANSLATION_Z][index] = translation.z;
+		this->components[ORIENTATION_X][index] = orientation.x;
+		this->components[ORIENTATION_Y][index] = orientation.y;
+		this->components[ORIENTATION_Z][index] = orientation.z;
+		this->components[ORIENTATION_W][index] = orientation.w;
+		this->components[SCALE_X][index] = scale.x;
+		this->components[SCALE_Y][index] = scale.y;
+		this->components[SCALE_Z][index] = scale.z;
+		this->lane_changed[index] = 1;
+		MarkDirty(index);
+	}
+
+	void TransformStore::Remove(const GUID entity_id) {
+		// Its children keep their link, and count it as the identity transform until it's added again. Only its own
+		// parent link goes.
+		if (this->parents.erase(entity_id) > 0 && !this->hierarchy_changed) {
+			Relink(entity_id, 0);
+		}
+
+		auto found = this->indices.find(entity_id);
+		if (found == this->indices.end()) {
+			return;
+		}
+		const size_t index = found->second;
+		const size_t last = this->entity_ids.size() - 1;
+		this->indices.erase(found);
+
+		if (this->lane_nodes[index] != NO_INDEX) {
+			// Its children now count it as the identity.
+			this->hierarchy[this->lane_nodes[index]].lane = NO_INDEX;
+			this->node_moved[this->lane_nodes[index]] = 1;
+		}
+
+		if (index != last) {
+			for (int component = 0; component < COMPONENT_COUNT; ++component) {
+				this->components[component][index] = this->components[component][last];
+			}
+			this->model_matrices[index] = this->model_matrices[last];
+			this->lane_changed[index] = this->lane_changed[last];
+			this->lane_nodes[index] = this->lane_nodes[last];
+			if (this->lane_nodes[index] != NO_INDEX) {
+				this->hierarchy[this->lane_nodes[index]].lane = static_cast<std::uint32_t>(index);
+			}
+			this->entity_ids[index] = this->entity_ids[last];
+			this->indices[this->entity_ids[index]] = static_cast<std::uint32_t>(index);
+			// The moved lane's matrix may be stale if its old block was waiting to be rebuilt.
+			if (this->block_dirty[last / BLOCK_SIZE]) {
+				MarkDirty(index);
+			}
+		}
+		Reset(last);
+		this->model_matrices[last] = glm::mat4(1.0f);
+		this->lane_changed[last] = 0;
+		this->lane_nodes[last] = NO_INDEX;
+		this->entity_ids.pop_back();
+
+		// Drop the last block once it's empty. It may still be queued as dirty, UpdateModelMatrices() skips it.
+		if (last % BLOCK_SIZE == 0) {
+			for (int component = 0; component < COMPONENT_COUNT; ++component) {
+				this->components[component].resize(last);
+			}
+			this->model_matrices.resize(last);
+			this->lane_changed.resize(last);
+			this->lane_nodes.resize(last);
+			this->block_dirty.pop_back();
+		}
+	}
+
+	const glm::mat4* TransformStore::GetModelMatrix(const GUID entity_id) const {
+		auto found = this->indices.find(entity_id);
+		if (found == this->indices.end()) {
+			return nullptr;
+		}
+		const std::uint32_t node = this->lane_nodes[found->second];
+		if (node != NO_INDEX) {
+			return &this->world_matrices[node];
+		}
+		return &this->model_matrices[found->second];
+	}
+
+	bool TransformStore::SetParent(const GUID entity_id, const GUID parent_id) {
+		if (GetParent(entity_id) == parent_id) {
+			return true;
+		}
+		if (parent_id == 0) {
+			this->parents.erase(entity_id);
+		}
+		else {
+			for (GUID ancestor = parent_id; ancestor != 0; ancestor = GetParent(ancestor)) {
+				if (ancestor == entity_id) {
+					return false;
+				}
+			}
+			this->parents[entity_id] = parent_id;
+		}
+		// A pending rebuild reads every link from parents anyway.
+		if (!this->hierarchy_changed) {
+			Relink(entity_id, parent_id);
+		}
+		return true;
+	}
+
+	GUID TransformStore::GetParent(const GUID entity_id) const {
+		auto found = this->parents.find(entity_id);
+		if (found == this->parents.end()) {
+			return 0;
+		}
+		return found->second;
+	}
+
+	std::uint32_t TransformStore::AddNode(const GUID entity_id, const std::uint32_t parent) {
+		auto found = this->indices.find(entity_id);
+		const std::uint32_t node = static_cast<std::uint32_t>(this->hierarchy.size());
+		HierarchyNode added = {entity_id, found != this->indices.end() ? found->second : NO_INDEX, NO_INDEX, NO_INDEX,
+			NO_INDEX, NO_INDEX};
+		this->hierarchy.push_back(added);
+		this->hierarchy_indices[entity_id] = node;
+		if (added.lane != NO_INDEX) {
+			this->lane_nodes[added.lane] = node;
+		}
+		if (parent != NO_INDEX) {
+			LinkChild(node, parent);
+		}
+		this->world_matrices.push_back(glm::mat4(1.0f));
+		this->node_moved.push_back(1);
+		return node;
+	}
+
+	void TransformStore::LinkChild(const std::uint32_t node, const std::uint32_t parent) {
+		HierarchyNode& child = this->hierarchy[node];
+		child.parent = parent;
+		child.previous_sibling = NO_INDEX;
+		child.next_sibling = this->hierarchy[parent].first_child;
+		if (child.next_sibling != NO_INDEX) {
+			this->hierarchy[child.next_sibling].previous_sibling = node;
+		}
+		this->hierarchy[parent].first_child = node;
+	}
+
+	void TransformStore::UnlinkChild(const std::uint32_t node) {
+		HierarchyNode& child = this->hierarchy[node];
+		if (child.previous_sibling != NO_INDEX) {
+			this->hierarchy[child.previous_sibling].next_sibling = child.next_sibling;
+		}
+		else {
+			this->hierarchy[child.parent].first_child = child.next_sibling;
+		}
+		if (child.next_sibling != NO_INDEX) {
+			this->hierarchy[child.next_sibling].previous_sibling = child.previous_sibling;
+		}
+		child.parent = NO_INDEX;
+		child.next_sibling = NO_INDEX;
+		child.previous_sibling = NO_INDEX;
+	}
+
+	void TransformStore::ReleaseIfAlone(const std::uint32_t node) {
+		HierarchyNode& alone = this->hierarchy[node];
+		if (alone.parent != NO_INDEX || alone.first_child != NO_INDEX) {
+			return;
+		}
+		this->hierarchy_indices.erase(alone.entity_id);
+		if (alone.lane != NO_INDEX) {
+			this->lane_nodes[alone.lane] = NO_INDEX;
+		}
+		alone.entity_id = 0;
+		alone.lane = NO_INDEX;
+		++this->dead_nodes;
+	}
+
+	void TransformStore::MoveSubtree(const std::uint32_t node, const std::uint32_t parent) {
+		// Collected breadth first, so each node's parent is copied before it.
+		const std::uint32_t end = static_cast<std::uint32_t>(this->hierarchy.size());
+		this->subtree.clear();
+		this->subtree.push_back(std::make_pair(node, parent));
+		for (size_t moved = 0; moved < this->subtree.size(); ++moved) {
+			const std::uint32_t new_index = end + static_cast<std::uint32_t>(moved);
+			for (std::uint32_t child = this->hierarchy[this->subtree[moved].first].first_child; child != NO_INDEX;
+				child = this->hierarchy[child].next_sibling) {
+				this->subtree.push_back(std::make_pair(child, new_index));
+			}
+		}
+
+		for (auto& moved : this->subtree) {
+			HierarchyNode copy = {this->hierarchy[moved.first].entity_id, this->hierarchy[moved.first].lane, NO_INDEX,
+				NO_INDEX, NO_INDEX, NO_INDEX};
+			const std::uint32_t new_index = static_cast<std::uint32_t>(this->hierarchy.size());
+			this->hierarchy.push_back(copy);
+			LinkChild(new_index, moved.second);
+			this->hierarchy_indices[copy.entity_id] = new_index;
+			if (copy.lane != NO_INDEX) {
+				this->lane_nodes[copy.lane] = new_index;
+			}
+			this->world_matrices.push_back(glm::mat4(1.0f));
+			this->node_moved.push_back(1);
+
+			// The entity's lookups already point at the copy, and the old subtree is only linked to itself.
+			HierarchyNode& dead = this->hierarchy[moved.first];
+			dead.entity_id = 0;
+			dead.lane = NO_INDEX;
+			dead.parent = NO_INDEX;
+			dead.first_child = NO_INDEX;
+			dead.next_sibling = NO_INDEX;
+			dead.previous_sibling = NO_INDEX;
+			++this->dead_nodes;
+		}
+	}
+
+	void TransformStore::Relink(const GUID entity_id, const GUID parent_id) {
+		auto found = this->hierarchy_indices.find(entity_id);
+		const std::uint32_t node = found != this->hierarchy_indices.end() ? found->second : NO_INDEX;
+
+		// Detach from the old parent, which leaves the hierarchy if that was its last child.
+		if (node != NO_INDEX && this->hierarchy[node].parent != NO_INDEX) {
+			const std::uint32_t old_parent = this->hierarchy[node].parent;
+			UnlinkChild(node);
+			this->node_moved[node] = 1;
+			ReleaseIfAlone(old_parent);
+		}
+
+		if (parent_id == 0) {
+			if (node != NO_INDEX) {
+				ReleaseIfAlone(node);
+			}
+		}
+		else {
+			auto parent_found = this->hierarchy_indices.find(parent_id);
+			const std::uint32_t parent = parent_found != this->hierarchy_indices.end() ? parent_found->second :
+				AddNode(parent_id, NO_INDEX);
+			if (node == NO_INDEX) {
+				AddNode(entity_id, parent);
+			}
+			else if (node > parent) {
+				// Already after its new parent, it stays where it is.
+				LinkChild(node, parent);
+				this->node_moved[node] = 1;
+			}
+			else {
+				MoveSubtree(node, parent);
+			}
+		}
+
+		// Compact once dead nodes make up half of the array.
+		if (this->dead_nodes * 2 >= this->hierarchy.size() && this->dead_nodes > 0) {
+			this->hierarchy_changed = true;
+		}
+	}
+
+	void TransformStore::RebuildHierarchy() {
+		this->links.clear();
+		for (auto& link : this->parents) {
+			this->links.push_back(std::make_pair(link.second, link.first));
+		}
+		std::sort(this->links.begin(), this->links.end());
+
+		this->hierarchy.clear();
+		this->hierarchy_indices.clear();
+		this->world_matrices.clear();
+		this->node_moved.clear();
+		this->dead_nodes = 0;
+		std::fill(this->lane_nodes.begin(), this->lane_nodes.end(), NO_INDEX);
+		// The tops are the parents without a parent of their own.
+		for (size_t link = 0; link < this->links.size(); ++link) {
+			const GUID parent_id = this->links[link].first;
+			if ((link == 0 || this->links[link - 1].first != parent_id) && this->parents.find(parent_id) == this->parents.end()) {
+				AddNode(parent_id, NO_INDEX);
+			}
+		}
+		// Each node's children are appended after every node before it, which keeps the array breadth first.
+		for (size_t node = 0; node < this->hierarchy.size(); ++node) {
+			auto children = std::equal_range(this->links.begin(), this->links.end(),
+				std::make_pair(this->hierarchy[node].entity_id, GUID(0)),
+				[] (const std::pair<GUID, GUID>& a, const std::pair<GUID, GUID>& b) { return a.first < b.first; });
+			for (auto child = children.first; child != children.second; ++child) {
+				AddNode(child->second, static_cast<std::uint32_t>(node));
+			}
+		}
+		this->hierarchy_changed = false;
+	}
+
+	void TransformStore::UpdateWorldMatrices() {
+		static const glm::mat4 identity(1.0f);
+		if (this->hierarchy_changed) {
+			RebuildHierarchy();
+		}
+
+		this->node_changed.resize(this->hierarchy.size());
+		for (size_t node = 0; node < this->hierarchy.size(); ++node) {
+			const HierarchyNode& current = this->hierarchy[node];
+			if (current.entity_id == 0) {
+				this->node_changed[node] = 0;
+				continue;
+			}
+			bool changed = this->node_moved[node] || (current.lane != NO_INDEX && this->lane_changed[current.lane]);
+			if (current.parent != NO_INDEX) {
+				changed = changed || this->node_changed[current.parent];
+			}
+			this->node_changed[node] = changed;
+			this->node_moved[node] = 0;
+			if (!changed) {
+				continue;
+			}
+			const glm::mat4& local = current.lane != NO_INDEX ? this->model_matrices[current.lane] : identity;
+			if (current.parent != NO_INDEX) {
+				this->world_matrices[node] = this->world_matrices[current.parent] * local;
+			}
+			else {
+				this->world_matrices[node] = local;
+			}
+			++this->world_matrix_updates;
+		}
+	}
+
+	size_t TransformStore::UpdateModelMatrices() {
+		void (*build)(const MatrixBlock&) = BuildBlockScalar;
+#ifdef VV_TRANSFORM_SSE
+		if (this->kernel == MATRIX_KERNEL_SSE) {
+			build = BuildBlockSSE;
+		}
+#endif
+
+		size_t rebuilt = 0;
+		MatrixBlock block;
+		for (std::uint32_t dirty : this->dirty_blocks) {
+			if (dirty >= this->block_dirty.size()) {
+				continue; // Removed since it was marked.
+			}
+			this->block_dirty[dirty] = false;
+			const size_t first = dirty * BLOCK_SIZE;
+			for (int component = 0; component < COMPONENT_COUNT; ++component) {
+				block.component[component] = &this->components[component][first];
+			}
+			block.out = &this->model_matrices[first][0][0];
+			build(block);
+			rebuilt += std::min(BLOCK_SIZE, this->entity_ids.size() - first);
+		}
+
+		this->world_matrix_updates = 0;
+		if (this->hierarchy_changed || !this->hierarchy.empty()) {
+			UpdateWorldMatrices();
+		}
+
+		for (std::uint32_t dirty : this->dirty_blocks) {
+			if (dirty < this->block_dirty.size()) {
+				std::fill_n(this->lane_changed.begin() + dirty * BLOCK_SIZE, BLOCK_SIZE, 0);
+			}
+		}
+		this->dirty_blocks.clear();
+		return rebuilt;
+	}
+}
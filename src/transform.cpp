@@ -1,11 +1,35 @@
 #include "transform.hpp"
 
 namespace vv {
+	std::mutex Transform::dirty_list_mutex;
+	std::vector<GUID> Transform::dirty_list;
+
 	Transform::Transform(GUID entity_id) :
-		orientation(glm::quat(1, 0, 0, 0)), scale(1.0f), entity_id(entity_id) { }
+		orientation(glm::quat(1, 0, 0, 0)), scale(1.0f), entity_id(entity_id), parent_id(0), dirty(false) {
+		// A new transform has no model matrix yet.
+		if (entity_id != 0) {
+			MarkDirty();
+		}
+	}
+
+	void Transform::MarkDirty() {
+		// Entity 0 is no entity, nothing will ever resolve it.
+		if (!this->dirty.exchange(true) && this->entity_id != 0) {
+			std::lock_guard<std::mutex> lock(dirty_list_mutex);
+			dirty_list.push_back(this->entity_id);
+		}
+	}
+
+	void Transform::TakeDirtyList(std::vector<GUID>& entity_ids) {
+		entity_ids.clear();
+		std::lock_guard<std::mutex> lock(dirty_list_mutex);
+		// Swapping keeps both vectors' capacity, so neither side allocates once they've grown.
+		entity_ids.swap(dirty_list);
+	}
 
 	void Transform::Translate(const glm::vec3 amount) {
 		this->translation += amount;
+		MarkDirty();
 	}
 
 	void Transform::Rotate(const glm::vec3 amount) {
@@ -13,10 +37,12 @@ namespace vv {
 
 		glm::quat change(this->rotation);
 		this->orientation = glm::normalize(change * this->orientation);
+		MarkDirty();
 	}
 
 	void Transform::OrientedTranslate(const glm::vec3 amount) {
 		this->translation += this->orientation * amount;
+		MarkDirty();
 	}
 
 	void Transform::OrientedRotate(const glm::vec3 amount) {
@@ -28,14 +54,17 @@ namespace vv {
 		glm::quat change = qX * qY * qZ;
 
 		this->orientation = glm::normalize(change * this->orientation);
+		MarkDirty();
 	}
 
 	void Transform::Scale(const glm::vec3 amount) {
 		this->scale *= amount;
+		MarkDirty();
 	}
 
 	void Transform::SetTranslation(const glm::vec3 new_translation) {
 		this->translation = new_translation;
+		MarkDirty();
 	}
 
 	void Transform::SetRotation(const glm::vec3 new_rotation) {
@@ -51,6 +80,7 @@ namespace vv {
 			this->orientation.w * this->orientation.w + this->orientation.x *
 			this->orientation.x - this->orientation.y * this->orientation.y -
 			this->orientation.z * this->orientation.z);
+		MarkDirty();
 	}
 
 	void Transform::SetOrientation(const glm::quat new_orientation) {
@@ -66,10 +96,17 @@ namespace vv {
 			this->orientation.w * this->orientation.w + this->orientation.x *
 			this->orientation.x - this->orientation.y * this->orientation.y -
 			this->orientation.z * this->orientation.z);
+		MarkDirty();
 	}
 
 	void Transform::SetScale(const glm::vec3 new_scale) {
 		this->scale = new_scale;
+		MarkDirty();
+	}
+
+	void Transform::SetParent(const GUID parent_id) {
+		this->parent_id = parent_id;
+		MarkDirty();
 	}
 
 	glm::vec3 Transform::GetTranslation() const {
@@ -0,0 +1,258 @@
+#include "voxel-octree.hpp"
+
+#include <algorithm>
+
+namespace vv {
+	const int VoxelOctree::DEPTH;
+	const std::uint32_t VoxelOctree::BRANCH_BIT;
+	const std::uint32_t VoxelOctree::EMPTY;
+
+	VoxelOctree::VoxelOctree() {
+		this->nodes.push_back(EMPTY);
+	}
+
+	std::uint32_t VoxelOctree::Get(const short row, const short column, const short slice) const {
+		const std::uint32_t u[3] = { Bias(row), Bias(column), Bias(slice) };
+		std::uint32_t value = this->nodes[0];
+		for (int bit = DEPTH - 1; value & BRANCH_BIT; --bit) {
+			value = this->nodes[(value & ~BRANCH_BIT) + ChildIndex(u, bit)];
+		}
+		return value;
+	}
+
+	std::uint32_t VoxelOctree::AllocateBlock(const std::uint32_t value) {
+		std::uint32_t block;
+		if (!this->free_blocks.empty()) {
+			block = this->free_blocks.back();
+			this->free_blocks.pop_back();
+		}
+		else {
+			block = static_cast<std::uint32_t>(this->nodes.size());
+			this->nodes.resize(this->nodes.size() + 8);
+		}
+		std::fill(this->nodes.begin() + block, this->nodes.begin() + block + 8, value);
+		return block;
+	}
+
+	std::uint32_t VoxelOctree::Store(const short row, const short column, const short slice, const std::uint32_t value) {
+		const std::uint32_t u[3] = { Bias(row), Bias(column), Bias(slice) };
+		std::uint32_t path[DEPTH];
+		int depth = 0;
+
+		// Walk down to the voxel, splitting any uniform node on the way that doesn't already hold value.
+		std::uint32_t node = 0;
+		for (int bit = DEPTH - 1; bit >= 0; --bit) {
+			std::uint32_t current = this->nodes[node];
+			if (!(current & BRANCH_BIT)) {
+				if (current == value) {
+					return value;
+				}
+				current = BRANCH_BIT | AllocateBlock(current);
+				this->nodes[node] = current;
+			}
+			path[depth++] = node;
+			node = (current & ~BRANCH_BIT) + ChildIndex(u, bit);
+		}
+
+		std::uint32_t previous = this->nodes[node];
+		this->nodes[node] = value;
+
+		// Walk back up, collapsing every parent whose children now all hold value.
+		while (depth > 0) {
+			std::uint32_t parent = path[--depth];
+			std::uint32_t first = this->nodes[parent] & ~BRANCH_BIT;
+			for (std::uint32_t child = first; child < first + 8; ++child) {
+				if (this->nodes[child] != value) {
+					return previous;
+				}
+			}
+			this->nodes[parent] = value;
+			this->free_blocks.push_back(first);
+		}
+		return previous;
+	}
+
+	long long VoxelOctree::StoreBox(const int min[3], const int max[3], const std::uint32_t value) {
+		for (int axis = 0; axis < 3; ++axis) {
+			if (min[axis] > max[axis]) {
+				return 0;
+			}
+		}
+		const std::uint32_t min_u[3] = { Bias(min[0]), Bias(min[1]), Bias(min[2]) };
+		const std::uint32_t max_u[3] = { Bias(max[0]), Bias(max[1]), Bias(max[2]) };
+		const std::uint32_t origin[3] = { 0, 0, 0 };
+		return StoreBoxNode(0, origin, DEPTH, min_u, max_u, value);
+	}
+
+	long long VoxelOctree::StoreBoxNode(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+		const std::uint32_t min[3], const std::uint32_t max[3], const std::uint32_t value) {
+		const std::uint32_t last = (1u << size_bits) - 1;
+		bool inside = true;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (origin[axis] > max[axis] || origin[axis] + last < min[axis]) {
+				return 0;
+			}
+			inside = inside && origin[axis] >= min[axis] && origin[axis] + last <= max[axis];
+		}
+
+		if (inside) {
+			long long delta = (value != EMPTY ? 1LL << (size_bits * 3) : 0) - CountSolid(node, size_bits);
+			ReleaseChildren(node);
+			this->nodes[node] = value;
+			return delta;
+		}
+
+		std::uint32_t current = this->nodes[node];
+		if (!(current & BRANCH_BIT)) {
+			if (current == value) {
+				return 0;
+			}
+			current = BRANCH_BIT | AllocateBlock(current);
+			this->nodes[node] = current;
+		}
+
+		const std::uint32_t first = current & ~BRANCH_BIT;
+		const int half_bits = size_bits - 1;
+		long long delta = 0;
+		bool uniform = true;
+		for (int child = 0; child < 8; ++child) {
+			const std::uint32_t child_origin[3] = { origin[0] + (((child >> 1) & 1u) << half_bits),
+				origin[1] + ((child & 1u) << half_bits), origin[2] + (((child >> 2) & 1u) << half_bits) };
+			delta += StoreBoxNode(first + child, child_origin, half_bits, min, max, value);
+			uniform = uniform && this->nodes[first + child] == value;
+		}
+		if (uniform) {
+			this->nodes[node] = value;
+			this->free_blocks.push_back(first);
+		}
+		return delta;
+	}
+
+	long long VoxelOctree::CountSolid(const std::uint32_t node, const int size_bits) const {
+		std::uint32_t value = this->nodes[node];
+		if (!(value & BRANCH_BIT)) {
+			return value != EMPTY ? 1LL << (size_bits * 3) : 0;
+		}
+		long long count = 0;
+		for (std::uint32_t child = 0; child < 8; ++child) {
+			count += CountSolid((value & ~BRANCH_BIT) + child, size_bits - 1);
+		}
+		return count;
+	}
+
+	void VoxelOctree::ReleaseChildren(const std::uint32_t node) {
+		std::uint32_t value = this->nodes[node];
+		if (!(value & BRANCH_BIT)) {
+			return;
+		}
+		for (std::uint32_t child = 0; child < 8; ++child) {
+			ReleaseChildren((value & ~BRANCH_BIT) + child);
+		}
+		this->free_blocks.push_back(value & ~BRANCH_BIT);
+	}
+
+	void VoxelOctree::ForEachSolid(const int min[3], const int max[3], const SolidVisitor& visit) const {
+		const std::uint32_t min_u[3] = { Bias(min[0]), Bias(min[1]), Bias(min[2]) };
+		const std::uint32_t max_u[3] = { Bias(max[0]), Bias(max[1]), Bias(max[2]) };
+		const std::uint32_t origin[3] = { 0, 0, 0 };
+		VisitSolid(0, origin, DEPTH, min_u, max_u, visit);
+	}
+
+	void VoxelOctree::VisitSolid(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+		const std::uint32_t min[3], const std::uint32_t max[3], const SolidVisitor& visit) const {
+		const std::uint32_t last = (1u << size_bits) - 1;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (origin[axis] > max[axis] || origin[axis] + last < min[axis]) {
+				return;
+			}
+		}
+
+		std::uint32_t value = this->nodes[node];
+		if (value == EMPTY) {
+			return;
+		}
+		if (!(value & BRANCH_BIT)) {
+			visit(Unbias(origin[0]), Unbias(origin[1]), Unbias(origin[2]), 1 << size_bits, static_cast<std::uint16_t>(value - 1));
+			return;
+		}
+
+		const int half_bits = size_bits - 1;
+		for (int child = 0; child < 8; ++child) {
+			const std::uint32_t child_origin[3] = { origin[0] + (((child >> 1) & 1u) << half_bits),
+				origin[1] + ((child & 1u) << half_bits), origin[2] + (((child >> 2) & 1u) << half_bits) };
+			VisitSolid((value & ~BRANCH_BIT) + child, child_origin, half_bits, min, max, visit);
+		}
+	}
+
+	bool VoxelOctree::ExtractChunk(const int base[3], VoxelChunk& chunk) const {
+		chunk.Reset();
+		const int max[3] = { base[0] + VoxelChunk::SIZE - 1, base[1] + VoxelChunk::SIZE - 1, base[2] + VoxelChunk::SIZE - 1 };
+		ForEachSolid(base, max, [&base, &max, &chunk] (const int row, const int column, const int slice, const int size,
+			const std::uint16_t material) {
+			// Clip the node to the block, a node bigger than the block covers all of it.
+			for (int s = std::max(slice, base[2]); s <= std::min(slice + size - 1, max[2]); ++s) {
+				for (int r = std::max(row, base[0]); r <= std::min(row + size - 1, max[0]); ++r) {
+					for (int c = std::max(column, base[1]); c <= std::min(column + size - 1, max[1]); ++c) {
+						chunk.Set(VoxelChunk::Index(r - base[0], c - base[1], s - base[2]), material);
+					}
+				}
+			}
+		});
+		return !chunk.IsEmpty();
+	}
+
+	void VoxelOctree::ExtractOccupancy(const int base[3], std::uint64_t occupancy[VoxelChunk::WORD_COUNT]) const {
+		memset(occupancy, 0, sizeof(std::uint64_t) * VoxelChunk::WORD_COUNT);
+		const int max[3] = { base[0] + VoxelChunk::SIZE - 1, base[1] + VoxelChunk::SIZE - 1, base[2] + VoxelChunk::SIZE - 1 };
+		ForEachSolid(base, max, [&base, &max, occupancy] (const int row, const int column, const int slice, const int size,
+			const std::uint16_t) {
+			for (int s = std::max(slice, base[2]); s <= std::min(slice + size - 1, max[2]); ++s) {
+				for (int r = std::max(row, base[0]); r <= std::min(row + size - 1, max[0]); ++r) {
+					for (int c = std::max(column, base[1]); c <= std::min(column + size - 1, max[1]); ++c) {
+						int index = VoxelChunk::Index(r - base[0], c - base[1], s - base[2]);
+						occupancy[index >> 6] |= std::uint64_t(1) << (index & 63);
+					}
+				}
+			}
+		});
+	}
+
+	void VoxelOctree::ForEachChunk(const std::function<void(const int row, const int column, const int slice)>& visit,
+		const bool skip_buried) const {
+		const std::uint32_t origin[3] = { 0, 0, 0 };
+		VisitChunks(0, origin, DEPTH, visit, skip_buried);
+	}
+
+	void VoxelOctree::VisitChunks(const std::uint32_t node, const std::uint32_t origin[3], const int size_bits,
+		const std::function<void(const int row, const int column, const int slice)>& visit, const bool skip_buried) const {
+		std::uint32_t value = this->nodes[node];
+		if (value == EMPTY) {
+			return;
+		}
+		if (size_bits == VoxelChunk::SIZE_BITS) {
+			visit(Unbias(origin[0]), Unbias(origin[1]), Unbias(origin[2]));
+			return;
+		}
+		if (value & BRANCH_BIT) {
+			const int half_bits = size_bits - 1;
+			for (int child = 0; child < 8; ++child) {
+				const std::uint32_t child_origin[3] = { origin[0] + (((child >> 1) & 1u) << half_bits),
+					origin[1] + ((child & 1u) << half_bits), origin[2] + (((child >> 2) & 1u) << half_bits) };
+				VisitChunks((value & ~BRANCH_BIT) + child, child_origin, half_bits, visit, skip_buried);
+			}
+			return;
+		}
+
+		// A solid node bigger than a chunk, only the chunks on its outer shell can touch anything else.
+		const int count = 1 << (size_bits - VoxelChunk::SIZE_BITS);
+		for (int s = 0; s < count; ++s) {
+			for (int r = 0; r < count; ++r) {
+				bool shell = !skip_buried || s == 0 || s == count - 1 || r == 0 || r == count - 1;
+				for (int c = 0; c < count; c += (shell || c == count - 1) ? 1 : count - 1) {
+					visit(Unbias(origin[0]) + r * VoxelChunk::SIZE, Unbias(origin[1]) + c * VoxelChunk::SIZE,
+						Unbias(origin[2]) + s * VoxelChunk::SIZE);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,88 @@
+#include "voxel-volume-manager.hpp"
+#include "vertexbuffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace vv {
+	VoxelVolumeManager::VoxelVolumeManager(const size_t thread_count) {
+		SetThreadCount(thread_count);
+	}
+
+	VoxelVolumeManager::~VoxelVolumeManager() { }
+
+	VoxelVolume* VoxelVolumeManager::AddVolume(const GUID entity_id, const VOXEL_STORAGE storage) {
+		ManagedVolume& managed = this->volumes[entity_id];
+		if (!managed.volume) {
+			managed.volume.reset(new VoxelVolume(storage));
+		}
+		return managed.volume.get();
+	}
+
+	void VoxelVolumeManager::RemoveVolume(const GUID entity_id) {
+		this->volumes.erase(entity_id);
+	}
+
+	VoxelVolume* VoxelVolumeManager::GetVolume(const GUID entity_id) const {
+		auto managed = this->volumes.find(entity_id);
+		if (managed == this->volumes.end()) {
+			return nullptr;
+		}
+		return managed->second.volume.get();
+	}
+
+	void VoxelVolumeManager::SetThreadCount(const size_t thread_count) {
+		size_t count = std::max<size_t>(thread_count, 1);
+		if (this->pool && this->pool->GetThreadCount() == count) {
+			return;
+		}
+		this->pool.reset(new WorkerPool(count));
+	}
+
+	void VoxelVolumeManager::Update(double delta) {
+		auto start_time = std::chrono::high_resolution_clock::now();
+		this->update_stats = VolumeUpdateStats();
+		this->update_stats.volume_count = this->volumes.size();
+
+		// Split the queued commands by entity. Each volume releases the commands it runs from the queue, so routing is
+		// just a pointer per command.
+		for (auto& managed : this->volumes) {
+			managed.second.commands.clear();
+		}
+		VoxelVolume::global_queue.Peek([this] (Command<VOXEL_COMMAND>* action) {
+			auto managed = this->volumes.find(action->entity_id);
+			if (managed == this->volumes.end()) {
+				VoxelVolume::global_queue.Release(action);
+				++this->update_stats.commands_unrouted;
+				return;
+			}
+			managed->second.commands.push_back(action);
+			++this->update_stats.commands_routed;
+		});
+
+		this->updating.clear();
+		for (auto& managed : this->volumes) {
+			if (!managed.second.commands.empty() || managed.second.volume->IsDirty()) {
+				this->updating.push_back(&managed.second);
+			}
+		}
+		this->update_stats.volumes_updated = this->updating.size();
+
+		this->pool->ParallelFor(this->updating.size(), [this] (const size_t index, const size_t) {
+			ManagedVolume* managed = this->updating[index];
+			managed->volume->ProcessCommands(managed->commands);
+			if (managed->volume->IsDirty()) {
+				managed->volume->UpdateVertexBuffers();
+			}
+		});
+
+		for (ManagedVolume* managed : this->updating) {
+			this->update_stats.commands_deferred += managed->volume->GetCommandStats().deferred;
+		}
+		// Reclaims the space of the commands that ran, any deferred ones stay queued for the next update.
+		VoxelVolume::global_queue.Drain([] (Command<VOXEL_COMMAND>*) { }, 0);
+
+		this->update_stats.update_time_ms = std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - start_time).count();
+	}
+}
@@ -1,171 +1,778 @@
 #include "voxelvolume.hpp"
 #include "vertexbuffer.hpp"
 
+#include <algorithm>
+#include <chrono>
+
 namespace vv {
-	std::atomic<std::queue<std::shared_ptr<Command<VOXEL_COMMAND>>>*> VoxelVolume::global_queue = new std::queue<std::shared_ptr<Command<VOXEL_COMMAND>>>();
+	// Cube corners for a voxel at the origin as lattice offsets (x, y, z). Front is +z, top is +y and right is +x.
+	static const struct {
+		int position[3];
+	} IdentityVerts[8] = {
+		// Front
+		{ { 0, 0, 1 } },	// Bottom left
+		{ { 1, 0, 1 } },	// Bottom right
+		{ { 1, 1, 1 } },	// Top right
+		{ { 0, 1, 1 } },	// Top Left
+		// Back
+		{ { 0, 0, 0 } },	// Bottom left
+		{ { 1, 0, 0 } },	// Bottom right
+		{ { 1, 1, 0 } },	// Top right
+		{ { 0, 1, 0 } }	// Top left
+	};
+
+	// The 2 triangles (as IdentityVerts indices) and the neighbor offset (row, column, slice) of each face, in FACE_DIRECTION order.
+	static const struct {
+		int corners[6];
+		int row, column, slice;
+	} VoxelFaces[FACE_COUNT] = {
+		{ { 0, 1, 2, 2, 3, 0 }, 0, 0, 1 },	// Front
+		{ { 3, 2, 6, 6, 7, 3 }, 1, 0, 0 },	// Top
+		{ { 7, 6, 5, 5, 4, 7 }, 0, 0, -1 },	// Back
+		{ { 4, 5, 1, 1, 0, 4 }, -1, 0, 0 },	// Bottom
+		{ { 4, 0, 3, 3, 7, 4 }, 0, -1, 0 },	// Left
+		{ { 1, 5, 6, 6, 2, 1 }, 0, 1, 0 },	// Right
+	};
 
-	VoxelVolume::VoxelVolume() { }
+	VoxelVolume::VoxelVolume(const VOXEL_STORAGE storage) : storage(storage), voxel_count(0), mesh_mode(MESH_CULLED) {
+		SetMeshThreadCount(1);
+	}
 
 	VoxelVolume::~VoxelVolume() { }
 
-	void VoxelVolume::AddVoxel(const short row, const short column, const short slice) {
-		Voxel v;
-		long long index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
+	VoxelChunk* VoxelVolume::FindChunk(const short row, const short column, const short slice) const {
+		auto chunk = this->chunks.find(ChunkKey(row, column, slice));
+		if (chunk == this->chunks.end()) {
+			return nullptr;
+		}
+		return chunk->second.get();
+	}
 
-		if (this->voxels.find(index) == this->voxels.end()) {
-			this->voxels[index] = v;
+	bool VoxelVolume::IsSolid(const short row, const short column, const short slice) const {
+		if (this->storage == STORAGE_OCTREE) {
+			return this->octree.IsSolid(row, column, slice);
+		}
+		VoxelChunk* chunk = FindChunk(row, column, slice);
+		if (!chunk) {
+			return false;
+		}
+		return chunk->IsSolid(VoxelChunk::Index(row & (VoxelChunk::SIZE - 1), column & (VoxelChunk::SIZE - 1), slice & (VoxelChunk::SIZE - 1)));
+	}
 
-			// Since we are adding a voxel we must set the new voxels neighors.
-			long long up_index, down_index, left_index, right_index, back_index, front_index;
-			up_index = (unsigned long long((row + 1) & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			down_index = (unsigned long long((row - 1) & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			left_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int((column - 1) & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			right_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int((column + 1) & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			front_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned((slice - 1) & 0xFFFF);
-			back_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned((slice + 1) & 0xFFFF);
+	Voxel VoxelVolume::GetMaterial(const short row, const short column, const short slice) const {
+		if (this->storage == STORAGE_OCTREE) {
+			return this->octree.IsSolid(row, column, slice) ? this->materials[this->octree.GetMaterial(row, column, slice)] : Voxel();
+		}
+		VoxelChunk* chunk = FindChunk(row, column, slice);
+		int index = VoxelChunk::Index(row & (VoxelChunk::SIZE - 1), column & (VoxelChunk::SIZE - 1), slice & (VoxelChunk::SIZE - 1));
+		if (!chunk || !chunk->IsSolid(index)) {
+			return Voxel();
+		}
+		return this->materials[chunk->GetMaterial(index)];
+	}
 
-			if (this->voxels.find(up_index) != this->voxels.end()) {
-				v.neighbors[Voxel::UP] = &this->voxels[up_index];
-				this->voxels[up_index].neighbors[Voxel::DOWN] = &this->voxels[index];
+	std::uint16_t VoxelVolume::FindMaterial(const Voxel& material) {
+		for (size_t id = 0; id < this->materials.size(); ++id) {
+			if (this->materials[id] == material) {
+				return static_cast<std::uint16_t>(id);
 			}
-			if (this->voxels.find(down_index) != this->voxels.end()) {
-				v.neighbors[Voxel::DOWN] = &this->voxels[down_index];
-				this->voxels[down_index].neighbors[Voxel::UP] = &this->voxels[index];
-			}
-			if (this->voxels.find(left_index) != this->voxels.end()) {
-				v.neighbors[Voxel::LEFT] = &this->voxels[left_index];
-				this->voxels[left_index].neighbors[Voxel::RIGHT] = &this->voxels[index];
-			}
-			if (this->voxels.find(right_index) != this->voxels.end()) {
-				v.neighbors[Voxel::RIGHT] = &this->voxels[right_index];
-				this->voxels[right_index].neighbors[Voxel::LEFT] = &this->voxels[index];
+		}
+		// The shaders can't index past MAX_MATERIALS palette entries.
+		if (this->materials.size() >= MAX_MATERIALS) {
+			size_t closest = 0;
+			float closest_distance = 0.0f;
+			for (size_t id = 0; id < this->materials.size(); ++id) {
+				float distance = 0.0f;
+				for (int i = 0; i < 3; ++i) {
+					float delta = this->materials[id].color[i] - material.color[i];
+					distance += delta * delta;
+				}
+				if (id == 0 || distance < closest_distance) {
+					closest = id;
+					closest_distance = distance;
+				}
 			}
-			if (this->voxels.find(front_index) != this->voxels.end()) {
-				v.neighbors[Voxel::FRONT] = &this->voxels[front_index];
-				this->voxels[front_index].neighbors[Voxel::BACK] = &this->voxels[index];
+			return static_cast<std::uint16_t>(closest);
+		}
+		this->materials.push_back(material);
+		this->palette.insert(this->palette.end(), material.color, material.color + 3);
+		return static_cast<std::uint16_t>(this->materials.size() - 1);
+	}
+
+	void VoxelVolume::AddVoxel(const short row, const short column, const short slice, const Voxel& material) {
+		if (row > MAX_COORD || column > MAX_COORD || slice > MAX_COORD) {
+			return;
+		}
+		if (this->storage == STORAGE_OCTREE) {
+			std::uint16_t material_id = FindMaterial(material);
+			if (this->octree.IsSolid(row, column, slice) && this->octree.GetMaterial(row, column, slice) == material_id) {
+				return;
 			}
-			if (this->voxels.find(back_index) != this->voxels.end()) {
-				v.neighbors[Voxel::BACK] = &this->voxels[back_index];
-				this->voxels[back_index].neighbors[Voxel::FRONT] = &this->voxels[index];
+			if (this->octree.Set(row, column, slice, material_id)) {
+				++this->voxel_count;
 			}
+			MarkDirty(row, column, slice);
+			return;
+		}
+
+		MortonKey key = ChunkKey(row, column, slice);
+		auto& chunk = this->chunks[key];
+		if (!chunk) {
+			chunk.reset(new VoxelChunk());
 		}
+
+		int index = VoxelChunk::Index(row & (VoxelChunk::SIZE - 1), column & (VoxelChunk::SIZE - 1), slice & (VoxelChunk::SIZE - 1));
+		std::uint16_t material_id = FindMaterial(material);
+		if (chunk->IsSolid(index) && chunk->GetMaterial(index) == material_id) {
+			return;
+		}
+		if (chunk->Set(index, material_id)) {
+			++this->voxel_count;
+		}
+		MarkDirty(row, column, slice);
 	}
 
 	void VoxelVolume::RemoveVoxel(const short row, const short column, const short slice) {
-		long long index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
+		if (this->storage == STORAGE_OCTREE) {
+			if (this->octree.Clear(row, column, slice)) {
+				--this->voxel_count;
+				MarkDirty(row, column, slice);
+			}
+			return;
+		}
 
-		if (this->voxels.find(index) != this->voxels.end()) {
-			Voxel& v = this->voxels[index];
+		MortonKey key = ChunkKey(row, column, slice);
+		auto chunk = this->chunks.find(key);
+		if (chunk == this->chunks.end()) {
+			return;
+		}
 
-			long long up_index, down_index, left_index, right_index, back_index, front_index;
-			up_index = (unsigned long long((row + 1) & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			down_index = (unsigned long long((row - 1) & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			left_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int((column - 1) & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			right_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int((column + 1) & 0xFFFF) << 16) + unsigned(slice & 0xFFFF);
-			front_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned((slice - 1) & 0xFFFF);
-			back_index = (unsigned long long(row & 0xFFFF) << 32) + (unsigned int(column & 0xFFFF) << 16) + unsigned((slice + 1) & 0xFFFF);
+		int index = VoxelChunk::Index(row & (VoxelChunk::SIZE - 1), column & (VoxelChunk::SIZE - 1), slice & (VoxelChunk::SIZE - 1));
+		if (chunk->second->Clear(index)) {
+			--this->voxel_count;
+			MarkDirty(row, column, slice);
+			// Empty chunks are dropped so sparse edits don't leave dead chunks behind.
+			if (chunk->second->IsEmpty()) {
+				this->chunks.erase(chunk);
+			}
+		}
+	}
+
+	void VoxelVolume::MarkDirty(const short row, const short column, const short slice) {
+		const int local[3] = { row & (VoxelChunk::SIZE - 1), column & (VoxelChunk::SIZE - 1), slice & (VoxelChunk::SIZE - 1) };
+		MarkDirty(ChunkKey(row, column, slice), local, local);
+	}
 
-			if (this->voxels.find(up_index) != this->voxels.end()) {
-				this->voxels[up_index].neighbors[Voxel::DOWN] = nullptr;
+	void VoxelVolume::MarkDirty(const MortonKey key, const int min[3], const int max[3]) {
+		this->dirty_chunks.insert(key);
+
+		// Voxels on the chunk border also change whether the neighboring chunk's faces against them are hidden.
+		for (int axis = 0; axis < 3; ++axis) {
+			if (min[axis] == 0) {
+				this->dirty_chunks.insert(key.Offset(axis == 0 ? -1 : 0, axis == 1 ? -1 : 0, axis == 2 ? -1 : 0));
 			}
-			if (this->voxels.find(down_index) != this->voxels.end()) {
-				this->voxels[down_index].neighbors[Voxel::UP] = nullptr;
+			if (max[axis] == VoxelChunk::SIZE - 1) {
+				this->dirty_chunks.insert(key.Offset(axis == 0 ? 1 : 0, axis == 1 ? 1 : 0, axis == 2 ? 1 : 0));
 			}
-			if (this->voxels.find(left_index) != this->voxels.end()) {
-				this->voxels[left_index].neighbors[Voxel::RIGHT] = nullptr;
+		}
+	}
+
+	void VoxelVolume::MarkRegionDirty(const int min[3], const int max[3]) {
+		if (min[0] > max[0] || min[1] > max[1] || min[2] > max[2]) {
+			return;
+		}
+		for (int chunk_slice = min[2] >> VoxelChunk::SIZE_BITS; chunk_slice <= max[2] >> VoxelChunk::SIZE_BITS; ++chunk_slice) {
+			for (int chunk_row = min[0] >> VoxelChunk::SIZE_BITS; chunk_row <= max[0] >> VoxelChunk::SIZE_BITS; ++chunk_row) {
+				for (int chunk_column = min[1] >> VoxelChunk::SIZE_BITS; chunk_column <= max[1] >> VoxelChunk::SIZE_BITS; ++chunk_column) {
+					const int base[3] = { chunk_row * VoxelChunk::SIZE, chunk_column * VoxelChunk::SIZE, chunk_slice * VoxelChunk::SIZE };
+					int lo[3], hi[3];
+					for (int axis = 0; axis < 3; ++axis) {
+						lo[axis] = std::max(min[axis] - base[axis], 0);
+						hi[axis] = std::min(max[axis] - base[axis], VoxelChunk::SIZE - 1);
+					}
+					MarkDirty(ChunkKey(base[0], base[1], base[2]), lo, hi);
+				}
 			}
-			if (this->voxels.find(right_index) != this->voxels.end()) {
-				this->voxels[right_index].neighbors[Voxel::LEFT] = nullptr;
+		}
+	}
+
+	template <typename Edit>
+	void VoxelVolume::EditRegion(const int min[3], const int max[3], const bool adds, Edit edit) {
+		const int first[3] = { min[0] >> VoxelChunk::SIZE_BITS, min[1] >> VoxelChunk::SIZE_BITS, min[2] >> VoxelChunk::SIZE_BITS };
+		const int last[3] = { max[0] >> VoxelChunk::SIZE_BITS, max[1] >> VoxelChunk::SIZE_BITS, max[2] >> VoxelChunk::SIZE_BITS };
+		for (int chunk_slice = first[2]; chunk_slice <= last[2]; ++chunk_slice) {
+			for (int chunk_row = first[0]; chunk_row <= last[0]; ++chunk_row) {
+				for (int chunk_column = first[1]; chunk_column <= last[1]; ++chunk_column) {
+					const int base[3] = { chunk_row * VoxelChunk::SIZE, chunk_column * VoxelChunk::SIZE, chunk_slice * VoxelChunk::SIZE };
+					MortonKey key = ChunkKey(base[0], base[1], base[2]);
+
+					VoxelChunk* chunk = nullptr;
+					if (this->storage == STORAGE_CHUNKS) {
+						auto found = this->chunks.find(key);
+						if (found == this->chunks.end()) {
+							if (!adds) {
+								continue;
+							}
+							found = this->chunks.emplace(key, std::unique_ptr<VoxelChunk>(new VoxelChunk())).first;
+						}
+						chunk = found->second.get();
+					}
+
+					// The part of the box inside this chunk, in local coordinates, and the bounds of the voxels that changed.
+					int lo[3], hi[3];
+					int changed_min[3] = { VoxelChunk::SIZE, VoxelChunk::SIZE, VoxelChunk::SIZE };
+					int changed_max[3] = { -1, -1, -1 };
+					for (int axis = 0; axis < 3; ++axis) {
+						lo[axis] = std::max(min[axis] - base[axis], 0);
+						hi[axis] = std::min(max[axis] - base[axis], VoxelChunk::SIZE - 1);
+					}
+
+					for (int s = lo[2]; s <= hi[2]; ++s) {
+						for (int r = lo[0]; r <= hi[0]; ++r) {
+							for (int c = lo[1]; c <= hi[1]; ++c) {
+								const short row = static_cast<short>(base[0] + r);
+								const short column = static_cast<short>(base[1] + c);
+								const short slice = static_cast<short>(base[2] + s);
+								int result = edit(row, column, slice);
+								if (result == KEEP_VOXEL) {
+									continue;
+								}
+
+								bool changed;
+								if (chunk) {
+									int index = VoxelChunk::Index(r, c, s);
+									if (result == CLEAR_VOXEL) {
+										changed = chunk->Clear(index);
+										this->voxel_count -= changed ? 1 : 0;
+									}
+									else {
+										changed = !chunk->IsSolid(index) || chunk->GetMaterial(index) != result;
+										this->voxel_count += chunk->Set(index, static_cast<std::uint16_t>(result)) ? 1 : 0;
+									}
+								}
+								else if (result == CLEAR_VOXEL) {
+									changed = this->octree.Clear(row, column, slice);
+									this->voxel_count -= changed ? 1 : 0;
+								}
+								else {
+									changed = !this->octree.IsSolid(row, column, slice) || this->octree.GetMaterial(row, column, slice) != result;
+									this->voxel_count += this->octree.Set(row, column, slice, static_cast<std::uint16_t>(result)) ? 1 : 0;
+								}
+
+								if (changed) {
+									const int local[3] = { r, c, s };
+									for (int axis = 0; axis < 3; ++axis) {
+										changed_min[axis] = std::min(changed_min[axis], local[axis]);
+										changed_max[axis] = std::max(changed_max[axis], local[axis]);
+									}
+								}
+							}
+						}
+					}
+
+					if (changed_max[0] >= 0) {
+						MarkDirty(key, changed_min, changed_max);
+					}
+					if (chunk && chunk->IsEmpty()) {
+						this->chunks.erase(key);
+					}
+				}
 			}
-			if (this->voxels.find(front_index) != this->voxels.end()) {
-				this->voxels[front_index].neighbors[Voxel::BACK] = nullptr;
+		}
+	}
+
+	// Clamps a region coordinate to the range voxels can be added in.
+	static int ClampCoord(const int coord) {
+		return std::min<int>(std::max(coord, -32768), VoxelVolume::MAX_COORD);
+	}
+
+	void VoxelVolume::FillBox(const short min[3], const short max[3], const Voxel& material) {
+		const int first[3] = { min[0], min[1], min[2] };
+		const int last[3] = { ClampCoord(max[0]), ClampCoord(max[1]), ClampCoord(max[2]) };
+		if (first[0] > last[0] || first[1] > last[1] || first[2] > last[2]) {
+			return;
+		}
+		std::uint16_t material_id = FindMaterial(material);
+		if (this->storage == STORAGE_OCTREE) {
+			// The octree replaces whole nodes inside the box, so only the dirty chunks are walked.
+			this->voxel_count += this->octree.FillBox(first, last, material_id);
+			MarkRegionDirty(first, last);
+			return;
+		}
+		EditRegion(first, last, true, [material_id] (const short, const short, const short) {
+			return static_cast<int>(material_id);
+		});
+	}
+
+	void VoxelVolume::CarveBox(const short min[3], const short max[3]) {
+		const int first[3] = { min[0], min[1], min[2] };
+		const int last[3] = { max[0], max[1], max[2] };
+		if (this->storage == STORAGE_OCTREE) {
+			this->voxel_count += this->octree.ClearBox(first, last);
+			MarkRegionDirty(first, last);
+			return;
+		}
+		EditRegion(first, last, false, [] (const short, const short, const short) {
+			return CLEAR_VOXEL;
+		});
+	}
+
+	void VoxelVolume::FillSphere(const short row, const short column, const short slice, const short radius,
+		const Voxel& material) {
+		if (radius < 0) {
+			return;
+		}
+		const int first[3] = { ClampCoord(row - radius), ClampCoord(column - radius), ClampCoord(slice - radius) };
+		const int last[3] = { ClampCoord(row + radius), ClampCoord(column + radius), ClampCoord(slice + radius) };
+		// Offsets span up to twice the short range, so their squares are summed in 64 bits.
+		const std::int64_t radius_squared = static_cast<std::int64_t>(radius) * radius;
+		int material_id = FindMaterial(material);
+		EditRegion(first, last, true, [=] (const short r, const short c, const short s) {
+			std::int64_t dr = r - row, dc = c - column, ds = s - slice;
+			return dr * dr + dc * dc + ds * ds <= radius_squared ? material_id : KEEP_VOXEL;
+		});
+	}
+
+	void VoxelVolume::CarveSphere(const short row, const short column, const short slice, const short radius) {
+		if (radius < 0) {
+			return;
+		}
+		const int first[3] = { ClampCoord(row - radius), ClampCoord(column - radius), ClampCoord(slice - radius) };
+		const int last[3] = { ClampCoord(row + radius), ClampCoord(column + radius), ClampCoord(slice + radius) };
+		const std::int64_t radius_squared = static_cast<std::int64_t>(radius) * radius;
+		EditRegion(first, last, false, [=] (const short r, const short c, const short s) {
+			std::int64_t dr = r - row, dc = c - column, ds = s - slice;
+			return dr * dr + dc * dc + ds * ds <= radius_squared ? CLEAR_VOXEL : KEEP_VOXEL;
+		});
+	}
+
+	void VoxelVolume::PasteBrush(const short row, const short column, const short slice, const VoxelBrush& brush) {
+		if (brush.GetSize(0) <= 0 || brush.GetSize(1) <= 0 || brush.GetSize(2) <= 0) {
+			return;
+		}
+		const int first[3] = { row, column, slice };
+		const int last[3] = { ClampCoord(row + brush.GetSize(0) - 1), ClampCoord(column + brush.GetSize(1) - 1),
+			ClampCoord(slice + brush.GetSize(2) - 1) };
+		// Brush materials are looked up in the volume once, not per voxel.
+		std::vector<int> material_ids;
+		for (const Voxel& material : brush.GetMaterials()) {
+			material_ids.push_back(FindMaterial(material));
+		}
+		EditRegion(first, last, true, [&] (const short r, const short c, const short s) {
+			int slot = brush.GetSlot(r - row, c - column, s - slice);
+			return slot < 0 ? KEEP_VOXEL : material_ids[slot];
+		});
+	}
+
+	void VoxelVolume::SetMeshThreadCount(const size_t thread_count) {
+		size_t count = std::max<size_t>(thread_count, 1);
+		if (this->mesh_pool && this->mesh_pool->GetThreadCount() == count) {
+			return;
+		}
+		this->mesh_pool.reset(new WorkerPool(count));
+		this->corner_tables.resize(count);
+		for (auto& corners : this->corner_tables) {
+			if (!corners) {
+				corners.reset(new CornerTable());
 			}
-			if (this->voxels.find(back_index) != this->voxels.end()) {
-				this->voxels[back_index].neighbors[Voxel::FRONT] = nullptr;
+		}
+		if (this->storage == STORAGE_OCTREE) {
+			this->octree_blocks.resize(count);
+			for (auto& block : this->octree_blocks) {
+				if (!block) {
+					block.reset(new OctreeBlock());
+				}
 			}
-			this->voxels.erase(index);
 		}
 	}
 
+	void VoxelVolume::MarkAllDirty() {
+		if (this->storage == STORAGE_OCTREE) {
+			// Chunks buried in a solid region have no exposed faces, except when every face is drawn.
+			this->octree.ForEachChunk([this] (const int row, const int column, const int slice) {
+				this->dirty_chunks.insert(ChunkKey(row, column, slice));
+			}, this->mesh_mode != MESH_CUBES);
+			return;
+		}
+		for (auto& chunk : this->chunks) {
+			this->dirty_chunks.insert(chunk.first);
+		}
+	}
+
+	VoxelMemoryReport VoxelVolume::GetMemoryReport() const {
+		VoxelMemoryReport report;
+		report.voxel_count = this->voxel_count;
+		report.chunk_count = this->chunks.size();
+
+		// Each chunk is a hash node (next pointer, key and chunk pointer), a bucket pointer, the chunk itself and its
+		// palette and packed material indices. The volume's material list is shared by all chunks.
+		report.chunk_bytes = this->chunks.size() * (sizeof(void*) * 2 + sizeof(MortonKey) + sizeof(VoxelChunk)) +
+			this->chunks.bucket_count() * sizeof(void*) + this->materials.capacity() * sizeof(Voxel);
+		for (auto& chunk : this->chunks) {
+			report.chunk_bytes += chunk.second->GetHeapBytes();
+		}
+
+		// The per voxel hash map stored a node (next pointer, key, color and 6 neighbor pointers) per voxel,
+		// one bucket per voxel at the default load factor and the allocator's per node header.
+		struct HashMapNode {
+			void* next;
+			long long key;
+			float color[3];
+			void* neighbors[6];
+		};
+		report.octree_node_count = this->storage == STORAGE_OCTREE ? this->octree.GetNodeCount() : 0;
+		report.octree_bytes = this->octree.GetMemoryBytes();
+		report.hash_map_bytes = this->voxel_count * (sizeof(HashMapNode) + sizeof(void*) + sizeof(void*) * 2);
+
+		return report;
+	}
+
 	void VoxelVolume::Update(double delta) {
 		ProcessCommandQueue();
-		UpdateVertexBuffers();
+		if (IsDirty()) {
+			UpdateVertexBuffers();
+		}
 	}
 
 	void VoxelVolume::ProcessCommandQueue() {
-		auto queue = global_queue.exchange(this->local_queue);
+		this->pending_commands.clear();
+		global_queue.Peek([this] (Command<VOXEL_COMMAND>* action) {
+			this->pending_commands.push_back(action);
+		});
+		ProcessCommands(this->pending_commands);
+		// Reclaims the space of the commands that ran, any deferred ones stay queued for the next update.
+		global_queue.Drain([] (Command<VOXEL_COMMAND>*) { }, 0);
+	}
+
+	void VoxelVolume::ProcessCommands(const std::vector<Command<VOXEL_COMMAND>*>& commands) {
+		this->coalescer.Begin();
+		if (this->coalesce_commands) {
+			// Only the last add or remove of each voxel matters. Region edits touch many voxels, so nothing is
+			// coalesced across them.
+			for (size_t index = 0; index < commands.size(); ++index) {
+				Command<VOXEL_COMMAND>* action = commands[index];
+				if (action->command == VOXEL_ADD || action->command == VOXEL_REMOVE) {
+					auto voxel_action = static_cast<VoxelCommand*>(action);
+					this->coalescer.Add(MortonKey::Encode(voxel_action->row, voxel_action->column, voxel_action->slice).value, 0, index);
+				}
+				else {
+					this->dropped_commands += this->coalescer.Resolve();
+				}
+			}
+			this->dropped_commands += this->coalescer.Resolve();
+		}
 
-		while (!queue->empty()) {
-			auto action = queue->front();
-			queue->pop();
-			auto voxel_action = static_cast<VoxelCommand*>(action.get());
+		RunCommands(commands, [] (Command<VOXEL_COMMAND>*) { return false; }, [this] (Command<VOXEL_COMMAND>* action) {
+			auto voxel_action = static_cast<VoxelCommand*>(action);
 
 			switch (action->command) {
 			case VOXEL_ADD:
-			AddVoxel(voxel_action->row, voxel_action->column, voxel_action->slice);
+			AddVoxel(voxel_action->row, voxel_action->column, voxel_action->slice, voxel_action->material);
 			break;
 			case VOXEL_REMOVE:
 			RemoveVoxel(voxel_action->row, voxel_action->column, voxel_action->slice);
 			break;
+			case VOXEL_FILL_BOX:
+			{
+				auto box = static_cast<VoxelBoxCommand*>(action);
+				FillBox(box->min, box->max, box->material);
+			}
+			break;
+			case VOXEL_CARVE_BOX:
+			{
+				auto box = static_cast<VoxelBoxCommand*>(action);
+				CarveBox(box->min, box->max);
+			}
+			break;
+			case VOXEL_FILL_SPHERE:
+			{
+				auto sphere = static_cast<VoxelSphereCommand*>(action);
+				FillSphere(sphere->row, sphere->column, sphere->slice, sphere->radius, sphere->material);
+			}
+			break;
+			case VOXEL_CARVE_SPHERE:
+			{
+				auto sphere = static_cast<VoxelSphereCommand*>(action);
+				CarveSphere(sphere->row, sphere->column, sphere->slice, sphere->radius);
+			}
+			break;
+			case VOXEL_PASTE_BRUSH:
+			{
+				auto paste = static_cast<VoxelBrushCommand*>(action);
+				if (paste->brush) {
+					PasteBrush(paste->row, paste->column, paste->slice, *paste->brush);
+				}
+			}
+			break;
+			}
+		});
+	}
+
+	// True if mask_index refers to an exposed voxel made of the same material.
+	static bool SameMaterial(const VoxelChunk* chunk, const int mask_index, const std::uint16_t material) {
+		return mask_index >= 0 && chunk->GetMaterial(mask_index) == material;
+	}
+
+	unsigned int VoxelVolume::AddVertex(ChunkMesh& mesh, CornerTable& corners, const int x, const int y, const int z,
+		const unsigned short color) {
+		// Lattice (x, y, z) maps to (column, row, slice).
+		int corner = (x - mesh.base[1]) + ((y - mesh.base[0]) + (z - mesh.base[2]) * CORNER_SIZE) * CORNER_SIZE;
+		if (corners.stamp[corner] == corners.generation && corners.color[corner] == color) {
+			return corners.index[corner];
+		}
+		unsigned int vert_index = static_cast<unsigned int>(mesh.verts.size());
+		mesh.verts.push_back(PackedVertex(static_cast<GLshort>(x), static_cast<GLshort>(y), static_cast<GLshort>(z), color));
+		corners.index[corner] = vert_index;
+		corners.stamp[corner] = corners.generation;
+		corners.color[corner] = color;
+		return vert_index;
+	}
+
+	void VoxelVolume::AddFace(ChunkMesh& mesh, CornerTable& corners, const int face, const int start[3], const int end[3],
+		const unsigned short color) {
+		// IdentityVerts components are (x, y, z) which map to (column, row, slice).
+		static const int vertex_axis[3] = { 1, 0, 2 };
+		GLuint index[8];
+		for (int corner : VoxelFaces[face].corners) {
+			int position[3];
+			for (int i = 0; i < 3; ++i) {
+				int axis = vertex_axis[i];
+				position[i] = IdentityVerts[corner].position[i] ? end[axis] + 1 : start[axis];
+			}
+			index[corner] = AddVertex(mesh, corners, position[0], position[1], position[2], color);
+		}
+		for (int corner : VoxelFaces[face].corners) {
+			mesh.indicies.push_back(index[corner]);
+		}
+		++mesh.faces_emitted;
+	}
+
+	void VoxelVolume::GreedyMeshChunk(ChunkMesh& mesh, CornerTable& corners, const VoxelChunk* chunk, const int base[3],
+		const std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT]) const {
+		const int size = VoxelChunk::SIZE;
+		// Dense index of the voxel whose face is exposed at each (u, v) of the current layer, or -1.
+		int mask[VoxelChunk::SIZE * VoxelChunk::SIZE];
+
+		for (int face = 0; face < FACE_COUNT; ++face) {
+			const int offset[3] = { VoxelFaces[face].row, VoxelFaces[face].column, VoxelFaces[face].slice };
+			// n is the axis the face points along, u and v span the face's plane.
+			int n = offset[0] ? 0 : (offset[1] ? 1 : 2);
+			int u = (n + 1) % 3;
+			int v = (n + 2) % 3;
+
+			for (int layer = 0; layer < size; ++layer) {
+				int local[3];
+				local[n] = layer;
+				for (int j = 0; j < size; ++j) {
+					local[v] = j;
+					for (int i = 0; i < size; ++i) {
+						local[u] = i;
+						int voxel_index = VoxelChunk::Index(local[0], local[1], local[2]);
+						bool is_exposed = ((exposed[face][voxel_index >> 6] >> (voxel_index & 63)) & 1) != 0;
+						mask[i + j * size] = is_exposed ? voxel_index : -1;
+					}
+				}
+
+				// Grow each unvisited exposed face along u then v while the material matches.
+				for (int j = 0; j < size; ++j) {
+					for (int i = 0; i < size;) {
+						int voxel_index = mask[i + j * size];
+						if (voxel_index < 0) {
+							++i;
+							continue;
+						}
+						std::uint16_t material = chunk->GetMaterial(voxel_index);
+
+						int width = 1;
+						while (i + width < size && SameMaterial(chunk, mask[i + width + j * size], material)) {
+							++width;
+						}
+						int height = 1;
+						for (; j + height < size; ++height) {
+							bool row_matches = true;
+							for (int k = 0; k < width; ++k) {
+								if (!SameMaterial(chunk, mask[i + k + (j + height) * size], material)) {
+									row_matches = false;
+									break;
+								}
+							}
+							if (!row_matches) {
+								break;
+							}
+						}
+
+						int start[3], end[3];
+						start[n] = end[n] = base[n] + layer;
+						start[u] = base[u] + i; end[u] = base[u] + i + width - 1;
+						start[v] = base[v] + j; end[v] = base[v] + j + height - 1;
+						AddFace(mesh, corners, face, start, end, material);
+						mesh.faces_merged += width * height - 1;
+
+						for (int h = 0; h < height; ++h) {
+							for (int k = 0; k < width; ++k) {
+								mask[i + k + (j + h) * size] = -1;
+							}
+						}
+						i += width;
+					}
+				}
+			}
+		}
+	}
+
+	void VoxelVolume::MeshChunk(ChunkMesh& mesh, CornerTable& corners, const VoxelChunk* chunk, const int base[3],
+		const std::uint64_t* const neighbors[FACE_COUNT]) const {
+		mesh = ChunkMesh();
+		mesh.base[0] = base[0]; mesh.base[1] = base[1]; mesh.base[2] = base[2];
+		// Bumping the generation invalidates every corner of the previous chunk without clearing the table.
+		if (++corners.generation == 0) {
+			memset(corners.stamp, 0, sizeof(corners.stamp));
+			corners.generation = 1;
+		}
+
+		// Exposed face bits for each direction, MESH_CUBES treats every face of a solid voxel as exposed.
+		const std::uint64_t* occupancy = chunk->GetOccupancy();
+		std::uint64_t exposed[FACE_COUNT][VoxelChunk::WORD_COUNT];
+		if (this->mesh_mode == MESH_CUBES) {
+			for (int face = 0; face < FACE_COUNT; ++face) {
+				memcpy(exposed[face], occupancy, sizeof(exposed[face]));
+			}
+		}
+		else {
+			ExtractExposedFaces(occupancy, neighbors, exposed);
+			for (int face = 0; face < FACE_COUNT; ++face) {
+				for (int w = 0; w < VoxelChunk::WORD_COUNT; ++w) {
+					mesh.faces_culled += PopCount(occupancy[w] & ~exposed[face][w]);
+				}
+			}
+		}
+
+		if (this->mesh_mode == MESH_GREEDY) {
+			GreedyMeshChunk(mesh, corners, chunk, base, exposed);
+			return;
+		}
+
+		for (int w = 0; w < VoxelChunk::WORD_COUNT; ++w) {
+			for (std::uint64_t solid = occupancy[w]; solid; solid &= solid - 1) {
+				int bit = CountTrailingZeros(solid);
+				int voxel_index = (w << 6) + bit;
+				int row = base[0] + VoxelChunk::Row(voxel_index);
+				int column = base[1] + VoxelChunk::Column(voxel_index);
+				int slice = base[2] + VoxelChunk::Slice(voxel_index);
+
+				std::uint16_t color = chunk->GetMaterial(voxel_index);
+
+				// Corners are only added to the vertex buffer once a face uses them.
+				GLuint index[8];
+				bool has_index[8] = { false, false, false, false, false, false, false, false };
+
+				for (int face = 0; face < FACE_COUNT; ++face) {
+					if (!((exposed[face][w] >> bit) & 1)) {
+						continue;
+					}
+					for (int corner : VoxelFaces[face].corners) {
+						if (!has_index[corner]) {
+							index[corner] = AddVertex(mesh, corners, column + IdentityVerts[corner].position[0],
+								row + IdentityVerts[corner].position[1], slice + IdentityVerts[corner].position[2], color);
+							has_index[corner] = true;
+						}
+						mesh.indicies.push_back(index[corner]);
+					}
+					++mesh.faces_emitted;
+				}
 			}
 		}
 	}
 
 	void VoxelVolume::UpdateVertexBuffers() {
-		this->verts.clear();
-		this->index_list.clear();
-		this->indicies.clear();
-		static std::vector<Vertex> IdentityVerts({
-			// Front
-			Vertex(-1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f),	// Bottom left
-			Vertex(1.0f, -1.0f, 1.0f, 0.0f, 1.0f, 0.0f),	// Bottom right
-			Vertex(1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f),		// Top right
-			Vertex(-1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f),	// Top Left
-			// Back
-			Vertex(-1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f),	// Bottom left
-			Vertex(1.0f, -1.0f, -1.0f, 0.0f, 1.0f, 0.0f),	// Bottom right
-			Vertex(1.0f, 1.0f, -1.0f, 0.0f, 0.0f, 1.0f),	// Top right
-			Vertex(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f)	// Top left
+		if (this->dirty_chunks.empty()) {
+			return;
+		}
+		auto start_time = std::chrono::high_resolution_clock::now();
+		this->mesh_stats = MeshStats();
+
+		// Only the dirty chunks are remeshed, every other chunk keeps its cached mesh. The mesh slots are
+		// created up front so the workers never touch chunk_meshes itself.
+		std::vector<std::pair<MortonKey, ChunkMesh*>> jobs;
+		jobs.reserve(this->dirty_chunks.size());
+		for (const MortonKey& key : this->dirty_chunks) {
+			// The octree has no per chunk lookup, so its dirty chunks are all meshed and the empty ones dropped afterwards.
+			if (this->storage == STORAGE_CHUNKS && this->chunks.find(key) == this->chunks.end()) {
+				this->chunk_meshes.erase(key);
+				continue;
+			}
+			jobs.push_back(std::make_pair(key, &this->chunk_meshes[key]));
+		}
+		this->dirty_chunks.clear();
+
+		this->mesh_pool->ParallelFor(jobs.size(), [this, &jobs] (size_t job, size_t worker) {
+			MortonKey key = jobs[job].first;
+			const int base[3] = { key.Row() * VoxelChunk::SIZE, key.Column() * VoxelChunk::SIZE, key.Slice() * VoxelChunk::SIZE };
+			const VoxelChunk* chunk;
+			if (this->storage == STORAGE_OCTREE) {
+				if (!this->octree.ExtractChunk(base, this->octree_blocks[worker]->chunk)) {
+					*jobs[job].second = ChunkMesh();
+					return;
+				}
+				chunk = &this->octree_blocks[worker]->chunk;
+			}
+			else {
+				chunk = this->chunks.at(key).get();
+			}
+
+			const bool cull = this->mesh_mode != MESH_CUBES;
+			const std::uint64_t* neighbors[FACE_COUNT];
+			for (int face = 0; face < FACE_COUNT; ++face) {
+				const int neighbor_base[3] = { base[0] + VoxelFaces[face].row * VoxelChunk::SIZE,
+					base[1] + VoxelFaces[face].column * VoxelChunk::SIZE, base[2] + VoxelFaces[face].slice * VoxelChunk::SIZE };
+				if (!cull) {
+					neighbors[face] = nullptr;
+				}
+				else if (this->storage == STORAGE_OCTREE) {
+					this->octree.ExtractOccupancy(neighbor_base, this->octree_blocks[worker]->neighbors[face]);
+					neighbors[face] = this->octree_blocks[worker]->neighbors[face];
+				}
+				else {
+					const VoxelChunk* neighbor = FindChunk(neighbor_base[0], neighbor_base[1], neighbor_base[2]);
+					neighbors[face] = neighbor ? neighbor->GetOccupancy() : nullptr;
+				}
+			}
+			MeshChunk(*jobs[job].second, *this->corner_tables[worker], chunk, base, neighbors);
 		});
+		this->mesh_stats.chunks_meshed = jobs.size();
+		if (this->storage == STORAGE_OCTREE) {
+			for (auto& job : jobs) {
+				if (job.second->indicies.empty()) {
+					this->chunk_meshes.erase(job.first);
+				}
+			}
+		}
 
-		for (auto v : this->voxels) {
-			short row = short((v.first & 0xFFFF00000000) >> 32);
-			short column = short((v.first & 0xFFFF0000) >> 16);
-			short slice = short(v.first & 0xFFFF);
-			GLuint index[8];
-
-			for (size_t i = 0; i < 8; ++i) {
-				auto vert_position = std::make_tuple(IdentityVerts[i].position[0] + column * 2,
-					IdentityVerts[i].position[1] + row * 2, IdentityVerts[i].position[2] + slice * 2);
-
-				if (this->index_list.find(vert_position) == this->index_list.end()) {
-					this->verts.push_back(Vertex(IdentityVerts[i].position[0] + column * 2,
-						IdentityVerts[i].position[1] + row * 2, IdentityVerts[i].position[2] + slice * 2,
-						IdentityVerts[i].color[0], IdentityVerts[i].color[1], IdentityVerts[i].color[2]));
-					//v.second.color[0], v.second.color[1], v.second.color[2]));
-					this->index_list[vert_position] = this->index_list.size();
-				}
-				index[i] = this->index_list[vert_position];
-			}
-
-			// Front
-			this->indicies.push_back(index[0]); this->indicies.push_back(index[1]); this->indicies.push_back(index[2]);
-			this->indicies.push_back(index[2]); this->indicies.push_back(index[3]); this->indicies.push_back(index[0]);
-			// Top
-			this->indicies.push_back(index[3]); this->indicies.push_back(index[2]); this->indicies.push_back(index[6]);
-			this->indicies.push_back(index[6]); this->indicies.push_back(index[7]); this->indicies.push_back(index[3]);
-			// Back
-			this->indicies.push_back(index[7]); this->indicies.push_back(index[6]); this->indicies.push_back(index[5]);
-			this->indicies.push_back(index[5]); this->indicies.push_back(index[4]); this->indicies.push_back(index[7]);
-			// Bottom
-			this->indicies.push_back(index[4]); this->indicies.push_back(index[5]); this->indicies.push_back(index[1]);
-			this->indicies.push_back(index[1]); this->indicies.push_back(index[0]); this->indicies.push_back(index[4]);
-			// Left
-			this->indicies.push_back(index[4]); this->indicies.push_back(index[0]); this->indicies.push_back(index[3]);
-			this->indicies.push_back(index[3]); this->indicies.push_back(index[7]); this->indicies.push_back(index[4]);
-			// Right
-			this->indicies.push_back(index[1]); this->indicies.push_back(index[5]); this->indicies.push_back(index[6]);
-			this->indicies.push_back(index[6]); this->indicies.push_back(index[2]); this->indicies.push_back(index[1]);
+		// Stitch the chunk meshes together in key order, offsetting each chunk's indices past the vertices before it.
+		size_t vertex_total = 0, index_total = 0;
+		for (auto& mesh : this->chunk_meshes) {
+			vertex_total += mesh.second.verts.size();
+			index_total += mesh.second.indicies.size();
 		}
+		this->verts.clear();
+		this->indicies.clear();
+		this->verts.reserve(vertex_total);
+		this->indicies.reserve(index_total);
+		for (auto& mesh : this->chunk_meshes) {
+			unsigned int base_vertex = static_cast<unsigned int>(this->verts.size());
+			this->verts.insert(this->verts.end(), mesh.second.verts.begin(), mesh.second.verts.end());
+			for (unsigned int index : mesh.second.indicies) {
+				this->indicies.push_back(base_vertex + index);
+			}
+			this->mesh_stats.faces_emitted += mesh.second.faces_emitted;
+			this->mesh_stats.faces_culled += mesh.second.faces_culled;
+			this->mesh_stats.faces_merged += mesh.second.faces_merged;
+		}
+
+		this->mesh_stats.vertex_count = this->verts.size();
+		this->mesh_stats.index_count = this->indicies.size();
+		this->mesh_stats.triangle_count = this->indicies.size() / 3;
+		this->mesh_stats.mesh_time_ms = std::chrono::duration<double, std::milli>(
+			std::chrono::high_resolution_clock::now() - start_time).count();
 	}
 }
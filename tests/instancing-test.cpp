@@ -0,0 +1,178 @@
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "render-system.hpp"
+#include "vertexbuffer.hpp"
+#include "shader.hpp"
+#include "material.hpp"
+#include "transform.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Renders the same entities with voxel.vert (a draw per entity) and voxel-instanced.vert (a draw per material) in a
+// headless GL 3.3 core context and checks the images match. Two materials share one vertex buffer, so its instance
+// buffer is rewritten between draws of the same frame.
+// Returns 0 on success, 1 on failure and 77 (skipped) if no headless context can be made.
+
+namespace {
+	const int WIDTH = 128;
+	const int HEIGHT = 96;
+	const size_t ENTITY_COUNT = 400;
+	const vv::GUID CAMERA_ID = 1;
+	const vv::GUID FIRST_ENTITY_ID = 100;
+	const int SKIPPED = 77;
+
+	bool CreateContext() {
+		auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+			eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (!get_platform_display) {
+			return false;
+		}
+		EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API)) {
+			return false;
+		}
+		const EGLint config_attributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_NONE };
+		EGLConfig config;
+		EGLint config_count = 0;
+		if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || !config_count) {
+			return false;
+		}
+		const EGLint context_attributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+		EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			return false;
+		}
+#ifndef __APPLE__
+		glewExperimental = GL_TRUE;
+		if (glewInit() != GLEW_OK) {
+			return false;
+		}
+		glGetError(); // glewInit() can leave GL_INVALID_ENUM behind on core contexts.
+#endif
+		return true;
+	}
+
+	// Without a window there is no default framebuffer, so everything is drawn into this one.
+	void CreateFramebuffer() {
+		GLuint framebuffer, renderbuffers[2];
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glGenRenderbuffers(2, renderbuffers);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+		glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	}
+
+	std::shared_ptr<vv::VertexBuffer> CreateCube() {
+		std::vector<vv::PackedVertex> verts;
+		for (int corner = 0; corner < 8; ++corner) {
+			verts.push_back(vv::PackedVertex(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1, corner % 3));
+		}
+		const GLuint faces[] = { 0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6, 0, 1, 5, 0, 5, 4,
+			2, 6, 7, 2, 7, 3, 0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5 };
+		std::vector<GLuint> indicies(faces, faces + sizeof(faces) / sizeof(faces[0]));
+		auto buffer = std::make_shared<vv::VertexBuffer>();
+		buffer->Buffer(verts, indicies);
+		buffer->SetPalette({ 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f });
+		return buffer;
+	}
+
+	// Draws a grid of cubes split between two materials and reads back the image. draw_calls is set to the draws of
+	// the last frame.
+	std::vector<unsigned char> Render(const char* vertex_shader, size_t& draw_calls) {
+		auto fill_shader = std::make_shared<vv::Shader>();
+		fill_shader->LoadFromFile(vv::Shader::VERTEX, std::string(VV_ASSET_DIR) + vertex_shader);
+		fill_shader->LoadFromFile(vv::Shader::FRAGMENT, std::string(VV_ASSET_DIR) + "basic.frag");
+		fill_shader->Build();
+		std::shared_ptr<vv::Material> materials[2] = { std::make_shared<vv::Material>(fill_shader),
+			std::make_shared<vv::Material>(fill_shader) };
+		auto cube = CreateCube();
+
+		vv::RenderSystem render_system;
+		render_system.SetViewportSize(WIDTH, HEIGHT);
+
+		std::vector<std::shared_ptr<vv::Transform>> transforms;
+		auto camera = std::make_shared<vv::Transform>(CAMERA_ID);
+		camera->SetTranslation(glm::vec3(0.0f, 0.0f, 60.0f));
+		vv::TransformMap::Set(CAMERA_ID, camera);
+		vv::RenderSystem::QueueCommand(vv::VIEW_ACTIVATE, CAMERA_ID);
+
+		const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(ENTITY_COUNT))));
+		for (size_t index = 0; index < ENTITY_COUNT; ++index) {
+			const vv::GUID entity_id = FIRST_ENTITY_ID + index;
+			auto transform = std::make_shared<vv::Transform>(entity_id);
+			transform->SetTranslation(glm::vec3((static_cast<int>(index % side) - side / 2) * 3.0f,
+				(static_cast<int>(index / side) - side / 2) * 3.0f, 0.0f));
+			transform->SetScale(glm::vec3(1.0f + (index % 3) * 0.2f));
+			transform->SetOrientation(glm::angleAxis(0.3f * index, glm::vec3(0.0f, 1.0f, 0.0f)));
+			vv::TransformMap::Set(entity_id, transform);
+			transforms.push_back(transform);
+			render_system.AddVertexBuffer(materials[index % 2], cube, entity_id);
+		}
+
+		// A few frames, so the instance buffer is reused across frames as well as within one.
+		for (int frame = 0; frame < 3; ++frame) {
+			render_system.Update(0.0);
+		}
+		draw_calls = render_system.GetRenderQueueStats().draw_calls;
+
+		std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+		glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		if (glGetError() != GL_NO_ERROR) {
+			pixels.clear();
+		}
+
+		for (size_t index = 0; index < ENTITY_COUNT; ++index) {
+			vv::TransformMap::Remove(FIRST_ENTITY_ID + index);
+		}
+		vv::TransformMap::Remove(CAMERA_ID);
+		return pixels;
+	}
+}
+
+int main() {
+	if (!CreateContext()) {
+		printf("No headless GL 3.3 context, skipping.\n");
+		return SKIPPED;
+	}
+	printf("%s / %s\n", glGetString(GL_VERSION), glGetString(GL_RENDERER));
+	CreateFramebuffer();
+
+	size_t per_entity_draws = 0, instanced_draws = 0;
+	std::vector<unsigned char> per_entity = Render("voxel.vert", per_entity_draws);
+	std::vector<unsigned char> instanced = Render("voxel-instanced.vert", instanced_draws);
+	if (per_entity.empty() || instanced.empty()) {
+		printf("GL error while rendering.\n");
+		return 1;
+	}
+
+	// RenderSystem clears to 0.3 gray, anything else was drawn.
+	size_t drawn = 0, differ = 0;
+	for (size_t pixel = 0; pixel < per_entity.size(); pixel += 4) {
+		if (per_entity[pixel] != 76 || per_entity[pixel + 1] != 76 || per_entity[pixel + 2] != 76) {
+			++drawn;
+		}
+		for (int channel = 0; channel < 4; ++channel) {
+			if (per_entity[pixel + channel] != instanced[pixel + channel]) {
+				++differ;
+				break;
+			}
+		}
+	}
+	printf("%zu entities: per entity %zu draws, instanced %zu draws, %zu pixels drawn, %zu differ\n", ENTITY_COUNT,
+		per_entity_draws, instanced_draws, drawn, differ);
+
+	// One draw per entity against one per material.
+	if (per_entity_draws != ENTITY_COUNT || instanced_draws != 2 || drawn == 0 || differ != 0) {
+		return 1;
+	}
+	return 0;
+}